@@ -0,0 +1,39 @@
+#!/bin/sh
+# large file mode: ':%s' followed by ':w' has to reach the file, including
+# rows in blocks that were evicted while the substitution ran. the editor
+# needs a terminal, so it is run under script(1) with the keys piped in
+set -e
+VOIDED=${VOIDED:-./voided}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+f="$dir/big.txt"
+
+# ~12MB of rows in memory against a 1MB budget
+awk 'BEGIN{for(i = 0; i < 200000; i++) print "a" i "a"}' > "$f"
+awk '{gsub(/a/, "x"); print}' "$f" > "$dir/want"
+
+# waits up to $2 tenths of a second for the shell test $1 to pass
+wait_for(){
+  n=0
+  while [ $n -lt "$2" ] && ! eval "$1"; do
+    sleep 0.1
+    n=$((n + 1))
+  done
+}
+
+# keys sent before the editor is in raw mode would be flushed, so the first
+# ones wait for its journal to appear. the file is then watched until the
+# substitution has been saved, however long that takes
+(
+  wait_for '[ -e "$dir/.big.txt.vswp" ]' 300
+  printf ':%%s/a/x/g\r:w\r'
+  wait_for 'cmp -s "$f" "$dir/want"' 1200
+  printf ':q\r'
+) | script -qec "stty rows 24 cols 80; $VOIDED -L -m 1 '$f'" /dev/null > /dev/null
+
+if cmp -s "$f" "$dir/want"; then
+  echo "lf_subst: ok"
+else
+  echo "lf_subst: FAILED, the saved file doesn't have the substitution"
+  exit 1
+fi
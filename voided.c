@@ -13,22 +13,54 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /*** defines ***/
 
 #define VOID_VERSION "0.2.2"
 #define VOID_TAB_STOP 8
 #define VOID_TAB_SIZE 2
 #define PROMPT_SIZE 128
+#define VOID_JOURNAL_BUF 65536   // journal records are buffered up to this size
+#define VOID_JOURNAL_SYNC 2      // seconds between fdatasync()s of the journal
+#define VOID_WATCH_TAIL 256      // bytes remembered from the end of the file
+#define VOID_MAX_THREADS 16
+#define VOID_PAR_BYTES (4 << 20) // smallest chunk of a file indexed by its own thread
+#define VOID_LF_BUDGET 512       // default memory budget (MB) for rows of large files
+#define VOID_LF_LINES 4096       // lines between checkpoints in large file mode
+#define VOID_LF_PIN 4            // most recently used blocks, never evicted
+#define VOID_LF_IO (8 << 20)     // read/write buffer for scanning and saving
+#define VOID_LZ_HASH 14          // log2 of the match finder's hash table size
+#define VOID_WORD_MIN 2          // shortest and longest words offered for completion
+#define VOID_WORD_MAX 128
+#define VOID_WORDS_RECENT 256    // new words held unsorted before being merged in
+#define VOID_COMPLETE_MAX 16     // completions offered at once
+#define VOID_WORDS_TOP 32        // words ranked for each one and two byte prefix
+#define VOID_WORDS_SHARE 4       // the word index of a buffer may use 1/this of the budget
+#define VOID_TYPEAHEAD 256       // keys held while a filter runs
 
 #define HELP_MSG "HELP: :w = save | :q = quit | / = find | Ctrl-H = help msg"
 
@@ -60,7 +92,7 @@ enum EdKey{
 enum Mode{
   NORMAL,
   INSERT,
-  //VISUAL,
+  VISUAL,
   //COMMAND,
 };
 
@@ -71,30 +103,221 @@ typedef struct erow{
   char *render;            // string that gets rendered
 } erow;
 
+// recovery journal: every edit is appended as a small binary record to a
+// swap file next to the edited file, so a crashed session can be replayed
+enum JournalOp{
+  J_INS_CHAR = 1,          // row, at, char
+  J_DEL_STR,               // row, at, len
+  J_INS_STR,               // row, at, len, bytes
+  J_INS_ROW,               // at, len, bytes
+  J_DEL_ROWS,              // at, count
+  J_SET_ROW,               // row, len, bytes
+};
+
+struct journal{
+  int fd;                  // -1 when there is no journal
+  char *path;
+  char buf[VOID_JOURNAL_BUF];
+  int len;                 // bytes in buf not yet written out
+  char unsynced;           // written since the last fdatasync()
+  time_t synced;
+  char replaying;          // don't log edits made while replaying
+  char asking;             // a view is being asked whether to replay it
+};
+
+#define JOURNAL_ON() (E.buf->jrn.fd != -1 && !E.buf->jrn.replaying && !E.buf->jrn.asking)
+
+// what the buffer knows about the file on disk, so that changes made by
+// other programs can be picked up incrementally (':watch')
+struct watch{
+  int fd;                  // inotify instance, -1 when not watching
+  int wd;
+  long size;               // bytes of the file the buffer was loaded from
+  char partial;            // the file didn't end in a newline
+  ino_t ino;
+  struct timespec mtime;
+  char tail[VOID_WATCH_TAIL];   // the bytes just before size, to tell appends
+  int taillen;                  // from rewrites
+};
+
+// large file mode: only a sparse table with the file offset of every
+// VOID_LF_LINES-th line is kept, and the blocks of rows between two
+// checkpoints are read in with pread() when they're needed. blocks are
+// evicted least recently used first to stay in budget: clean ones are just
+// dropped, edited ones are written to a spill file (with -z, every one is
+// compressed in memory instead) and read back when they're next used
+struct lblock{
+  long off, len;           // bytes of the file the block was read from
+  int first;               // buffer row the block starts at
+  int nrows;
+  erow *rows;              // only valid while loaded
+  char loaded;
+  char dirty;              // edited since the file was last saved
+  char stale;              // rows changed since cost was worked out
+  long cost;               // approximate bytes used while loaded
+  unsigned long used;      // LRU clock at last use
+  char *z;                 // the rows while evicted, if kept in memory
+  char zip;                // the evicted copy is compressed
+  long zlen, zraw;         // size of the evicted copy, and of the rows in it
+  long spill, spillcap;    // room the block has in the spill file
+};
+
+struct lfile{
+  char on;
+  int fd;
+  struct lblock *blocks;
+  int nblocks;
+  int *loaded;             // indexes of the loaded blocks
+  int nloaded;
+  long budget;             // bytes of rows allowed to stay loaded
+  long resident;
+  unsigned long clock;     // ticks whenever a different block is used
+  int last;                // block used last
+  char compress;           // evicted edits are compressed in memory, not spilled (-z)
+  long zlen, zraw;         // totals over every block compressed in memory, which
+                           // count against the budget along with resident
+  int spill;               // unlinked file for evicted edits, -1 until needed
+  long spillend;
+  char broken;             // rows couldn't be read back: saving would lose them
+};
+
+// word completion: every word in the buffer is interned once, in a hash
+// table counting its occurrences, and kept in a table sorted by text for
+// prefix lookups. words first seen after that table was sorted wait in a
+// short unsorted list until they're merged in. the file is scanned on a
+// thread after it's opened, while edits adjust the counts as they happen
+struct word{
+  int count;               // occurrences (briefly below 0 while scanning)
+  int len;
+  unsigned int hash;
+  unsigned char top;       // ranked under its first byte (1), first two (2)
+  char s[];
+};
+
+// the most frequent words starting with one or two given bytes, so that
+// completing a short prefix doesn't go through every word that has it
+struct wtop{
+  struct word *w[VOID_WORDS_TOP]; // most frequent first
+  int n;
+  int floor;               // no word left out has a higher count
+  struct wtop **next;      // by second byte, for one byte prefixes
+};
+
+struct words{
+  char on;                 // edits are counted
+  char ready;              // the scan is done: new words go to recent
+  char stop;               // the scan is to give up
+  char scanning;           // tid is running
+  int fd;                  // file being scanned
+  pthread_t tid;
+  pthread_mutex_t lock;
+  struct word **tab;       // open addressing, tabcap is a power of 2
+  long tabcap, ntab;
+  struct word **sorted;    // NULL until the scan is done
+  long nsorted;
+  struct word **recent;
+  int nrecent;
+  long bytes;              // held by the index, read without the lock
+  long limit;              // bytes it may grow to, 0 for no limit
+  char full;               // the limit was hit: new words are left out
+  char stale;              // rows went without being uncounted: rescanned on save
+  struct wtop **top;       // by first byte, NULL until the scan is done
+  long ndead;              // words whose count fell to 0 since the last sweep
+};
+
+// a file being edited. several views (see struct ed_config) can show the
+// same buffer at once when voided runs as a daemon
+struct ebuf{
+  int numrows;             // total number of rows
+  erow *row;               // holds all rows in the currently opened file
+  int dirty;
+  char *filename;
+  char loaded;             // filename has been read in (buffers load lazily)
+  int views;               // views showing the buffer right now
+  unsigned long used;      // bufclock when it was last shown
+  long mem;                // bytes held, as of when it was last left
+  int cx, cy;              // where the cursor was left
+  int rowoff, coloff;
+  struct journal jrn;
+  struct watch watch;
+  struct lfile lf;
+  struct words words;
+};
+
+// the state of one view on a buffer: the cursor, the screen and the
+// terminal it is drawn on
 struct ed_config{
   int cx, cy;              // cursor x and y
   int rx;                  // cursor x position in render string
   int rowoff, coloff;      // row offset and column offset
   int scrows, sccols;      // screen rows and screen columns (receives value from get_window_size())
-  int numrows;             // total number of rows
-  erow *row;               // holds all rows in the currently opened file
-  int dirty;
-  char *filename;
+  struct ebuf *buf;        // the buffer being viewed
   char statusmsg[80];
   time_t statusmsg_time;   // time elapsed since status msg was first drawn
   enum Mode mode;
+  int vx, vy;              // where the visual selection started
+  char vline;              // visual selection is line-wise ('V')
+  int reg;                 // register picked with '"' for the next yank or put
+  int infd, outfd;         // where keys come from and frames go to
+  char remote;             // view belongs to a client of the daemon
+  char lf_force;           // files opened here use large file mode whatever their size (-L)
+  char lf_compress;        // and keep evicted edits compressed in memory (-z)
+  char *cwd;               // the client's directory, NULL for our own
+  char quit;               // a remote view asked to detach
+  struct abuf *frame;      // lines last sent to the terminal, for diffing
+  int framerows;
   struct termios orig_term;
+  struct{                  // Ctrl-N/Ctrl-P in insert mode
+    char **cands;          // NULL unless a completion is in progress
+    int n, idx;            // idx == n stands for the prefix itself
+    char *prefix;
+    int row, start;        // where the word being completed starts
+  } comp;
+  struct{                  // the message bar prompt, while one is open
+    const char *fmt;       // NULL when there is none
+    char *buf;
+    size_t len, cap;
+    char confirm;          // answered with a single y or n
+    void (*done)(char *);  // takes what was typed, NULL if it was cancelled
+  } prompt;
+  char pending;            // first key of a two key command ('yy', '"a')
+  char ahead[VOID_TYPEAHEAD]; // keys typed while a filter ran, read before infd
+  int nahead;
 };
 
 struct ed_config E;        // global editor config
+struct ebuf **bufs;        // every buffer that is open
+int nbufs;
+unsigned long bufclock;    // ticks whenever a buffer is shown
+long lf_budget;            // memory budget (-m) for each large file, and for
+                           // all buffers together
 char tempbuf;              /* to deal with that pesky "label can only be part of a statement"
 			      compiler warning */
 /*** prototypes ***/
 
 void voided_set_status_msg(const char *fmt, const char t, ...);
 void voided_refresh_screen();
-char *voided_prompt(char *prompt);
+void voided_prompt(const char *fmt, void (*done)(char *));
+void voided_confirm(const char *fmt, const char *arg, void (*done)(char *));
 void voided_process_cmd(char *buf);
+char voided_save();
+void voided_journal_rec(const char op, const long a, const long b,
+                        const char *s, const long len);
+void voided_idle();
+char voided_remote_read_key();
+void voided_view_init(struct ebuf *b, const int infd, const int outfd);
+void voided_buf_unload(struct ebuf *b);
+char *voided_view_path(const char *name);
+erow *voided_lf_row(const int at);
+struct lblock *voided_lf_owner(const erow *row);
+void voided_lf_insert_rows(const int at, const erow *rows, const int n);
+void voided_lf_del_rows(const int start, const int end);
+void voided_words_span(const erow *row, int from, int to, const int delta);
+void voided_words_spans(struct words *w, const char *s, const long size, const long *at,
+                        const int n, const long len, const int delta);
+void voided_words_start(struct words *w, const int fd);
+void voided_words_free(struct words *w);
+long voided_words_mem(const struct words *w);
 
 /*** terminal ***/
 
@@ -138,8 +361,15 @@ void enable_raw_mode(){
 char voided_read_key(){
   int nread;
   char c;
+  if(E.nahead > 0){
+    c = E.ahead[0];
+    memmove(E.ahead, E.ahead + 1, --E.nahead);
+    return c;
+  }
+  if(E.remote) return voided_remote_read_key();
   while((nread = read(STDIN_FILENO, &c, 1)) != 1){
     if(nread == -1 && errno != EAGAIN) die("read");
+    voided_idle();
   }
   return c;
 }
@@ -176,8 +406,92 @@ int get_window_size(int *rows, int *cols){
     return 0;
   }
 }
+/*** threads ***/
+
+// how many worker threads to split big jobs across
+int voided_ncpus(){
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if(ncpu < 1) return 1;
+  return ncpu > VOID_MAX_THREADS ? VOID_MAX_THREADS : (int)ncpu;
+}
+
 /*** row operations ***/
 
+// row contents are refcounted so registers can share them with the buffer.
+// a shared string is never written to; whoever wants to modify it takes a
+// private copy first (see voided_row_reserve())
+typedef struct chars_hdr{
+  int refs;
+  int cap;                 // bytes allocated after the header
+} chars_hdr;
+
+#define CHARS_HDR(s) ((chars_hdr *)(s) - 1)
+
+// allocates a new refcounted string of len bytes, copied from s if not NULL
+char *voided_chars_new(const char *s, const size_t len){
+  chars_hdr *h = malloc(sizeof(chars_hdr) + len + 1);
+  h->refs = 1;
+  h->cap = len + 1;
+  char *chars = (char *)(h + 1);
+  if(s) memcpy(chars, s, len);
+  chars[len] = '\0';
+  return chars;
+}
+
+char *voided_chars_ref(char *chars){
+  __atomic_add_fetch(&CHARS_HDR(chars)->refs, 1, __ATOMIC_RELAXED);
+  return chars;
+}
+
+void voided_chars_unref(char *chars){
+  if(chars == NULL) return;
+  if(__atomic_sub_fetch(&CHARS_HDR(chars)->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    free(CHARS_HDR(chars));
+}
+
+// makes row->chars private to the row and big enough to hold len bytes plus
+// the terminator. must be called before writing to row->chars
+void voided_row_reserve(erow *row, size_t len){
+  chars_hdr *h = CHARS_HDR(row->chars);
+  if(len < (size_t)row->size) len = row->size;
+
+  if(__atomic_load_n(&h->refs, __ATOMIC_ACQUIRE) > 1){
+    char *chars = voided_chars_new(NULL, len);
+    memcpy(chars, row->chars, row->size + 1);
+    voided_chars_unref(row->chars);
+    row->chars = chars;
+  } else if((size_t)h->cap < len + 1){
+    h = realloc(h, sizeof(chars_hdr) + len + 1);
+    h->cap = len + 1;
+    row->chars = (char *)(h + 1);
+  }
+}
+
+// returns row at of the buffer. rows must always be reached through here,
+// as in large file mode they might not be in memory yet
+erow *voided_row(const int at){
+  if(E.buf->lf.on) return voided_lf_row(at);
+  return &E.buf->row[at];
+}
+
+// tells where in the buffer row is
+int voided_row_index(const erow *row){
+  if(E.buf->lf.on){
+    struct lblock *blk = voided_lf_owner(row);
+    return blk ? blk->first + (row - blk->rows) : 0;
+  }
+  return row - E.buf->row;
+}
+
+// bookkeeping for a change made to the contents of row
+void voided_row_modified(const erow *row){
+  if(E.buf->lf.on){
+    struct lblock *blk = voided_lf_owner(row);
+    if(blk) blk->dirty = blk->stale = 1;
+  }
+  E.buf->dirty++;
+}
+
 // converts cx to rx, dealing with tabs
 int voided_row_cx_to_rx(erow *row, const int cx){
   int rx = 0;
@@ -226,73 +540,266 @@ void voided_update_row(erow *row){
   row->rsize = idx;
 }
 
+// returns row's render string, building it first if it isn't there yet.
+// rows spliced in by bulk operations start without one, so only the rows
+// that actually get drawn or searched pay for it
+char *voided_row_render(erow *row){
+  if(row->render == NULL) voided_update_row(row);
+  return row->render;
+}
+
 // appends s of size len to row in position at
 void voided_insert_row(const int at, const char *s, const size_t len){
-  if(at < 0 || at > E.numrows) return;
+  if(at < 0 || at > E.buf->numrows) return;
+  if(E.buf->lf.on){
+    erow row = {len, 0, voided_chars_new(s, len), NULL};
+    voided_words_span(&row, 0, len, 1);
+    voided_lf_insert_rows(at, &row, 1);
+    if(JOURNAL_ON()) voided_journal_rec(J_INS_ROW, at, 0, s, len);
+    E.buf->dirty++;
+    return;
+  }
+
+  E.buf->row = realloc(E.buf->row, sizeof(erow) * (E.buf->numrows + 1));
+  memmove(&E.buf->row[at + 1], &E.buf->row[at], sizeof(erow) * (E.buf->numrows - at));
+
+  E.buf->row[at].size = len;
+  E.buf->row[at].chars = voided_chars_new(s, len);
+
+  E.buf->row[at].rsize = 0;
+  E.buf->row[at].render = NULL;
+  voided_update_row(&E.buf->row[at]);
+  voided_words_span(&E.buf->row[at], 0, len, 1);
 
-  E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-  memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
+  if(JOURNAL_ON()) voided_journal_rec(J_INS_ROW, at, 0, s, len);
 
-  E.row[at].size = len;
-  E.row[at].chars = malloc(len + 1);
-  memcpy(E.row[at].chars, s, len);
-  E.row[at].chars[len] = '\0';
+  E.buf->numrows++;
+  E.buf->dirty++;
+}
+
+// splices n already built rows in at position at, moving the row array only
+// once. the rows (and their strings) are taken over as they are
+void voided_insert_rows(const int at, const erow *rows, const int n){
+  if(at < 0 || at > E.buf->numrows || n <= 0) return;
 
-  E.row[at].rsize = 0;
-  E.row[at].render = NULL;
-  voided_update_row(&E.row[at]);
+  int i;
+  if(JOURNAL_ON()){
+    for(i = 0; i < n; i++)
+      voided_journal_rec(J_INS_ROW, at + i, 0, rows[i].chars, rows[i].size);
+  }
+  for(i = 0; i < n; i++)
+    voided_words_span(&rows[i], 0, rows[i].size, 1);
+  E.buf->dirty++;
+  if(E.buf->lf.on){
+    voided_lf_insert_rows(at, rows, n);
+    return;
+  }
 
-  E.numrows++;
-  E.dirty++;
+  E.buf->row = realloc(E.buf->row, sizeof(erow) * (E.buf->numrows + n));
+  memmove(&E.buf->row[at + n], &E.buf->row[at], sizeof(erow) * (E.buf->numrows - at));
+  memcpy(&E.buf->row[at], rows, sizeof(erow) * n);
+  E.buf->numrows += n;
 }
 
 void voided_free_row(erow *row){
   free(row->render);
-  free(row->chars);
+  voided_chars_unref(row->chars);
 }
 
 void voided_del_row(const int at){
-  if(at < 0 || at >= E.numrows) return;
-  voided_free_row(&E.row[at]);
-  memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-  E.numrows--;
-  E.dirty++;
+  if(at < 0 || at >= E.buf->numrows) return;
+  if(JOURNAL_ON()) voided_journal_rec(J_DEL_ROWS, at, 0, NULL, 1);
+  E.buf->dirty++;
+  if(E.buf->lf.on){
+    voided_lf_del_rows(at, at);
+    return;
+  }
+  voided_words_span(&E.buf->row[at], 0, E.buf->row[at].size, -1);
+  voided_free_row(&E.buf->row[at]);
+  memmove(&E.buf->row[at], &E.buf->row[at + 1], sizeof(erow) * (E.buf->numrows - at - 1));
+  E.buf->numrows--;
+}
+
+// deletes every row in [start, end] whose flag in del is set (del[0] is row
+// start). the row array is compacted in a single pass
+void voided_del_rows_marked(const int start, const int end, const unsigned char *del){
+  int r;
+  if(E.buf->lf.on){
+    // rows are spread over blocks: delete each run, last one first
+    r = end;
+    while(r >= start){
+      if(!del[r - start]){
+        r--;
+        continue;
+      }
+      int run_end = r;
+      while(r >= start && del[r - start]) r--;
+      if(JOURNAL_ON()) voided_journal_rec(J_DEL_ROWS, r + 1, 0, NULL, run_end - r);
+      voided_lf_del_rows(r + 1, run_end);
+      E.buf->dirty++;
+    }
+    return;
+  }
+  int w = start;
+  int run = 0;             // rows deleted since the last one that was kept
+  for(r = start; r <= end; r++){
+    if(del[r - start]){
+      voided_words_span(&E.buf->row[r], 0, E.buf->row[r].size, -1);
+      voided_free_row(&E.buf->row[r]);
+      run++;
+    } else{
+      if(run && JOURNAL_ON()) voided_journal_rec(J_DEL_ROWS, w, 0, NULL, run);
+      run = 0;
+      E.buf->row[w++] = E.buf->row[r];
+    }
+  }
+  if(run && JOURNAL_ON()) voided_journal_rec(J_DEL_ROWS, w, 0, NULL, run);
+  int removed = end + 1 - w;
+  if(removed == 0) return;
+  memmove(&E.buf->row[w], &E.buf->row[end + 1], sizeof(erow) * (E.buf->numrows - end - 1));
+  E.buf->numrows -= removed;
+  E.buf->dirty++;
+}
+
+// deletes rows [start, end] with a single memmove
+void voided_del_rows(const int start, const int end){
+  if(start < 0 || end >= E.buf->numrows || start > end) return;
+  if(JOURNAL_ON()) voided_journal_rec(J_DEL_ROWS, start, 0, NULL, end - start + 1);
+  E.buf->dirty++;
+  if(E.buf->lf.on){
+    voided_lf_del_rows(start, end);
+    return;
+  }
+  int r;
+  for(r = start; r <= end; r++){
+    voided_words_span(&E.buf->row[r], 0, E.buf->row[r].size, -1);
+    voided_free_row(&E.buf->row[r]);
+  }
+  memmove(&E.buf->row[start], &E.buf->row[end + 1], sizeof(erow) * (E.buf->numrows - end - 1));
+  E.buf->numrows -= end - start + 1;
+}
+
+// replaces rows [start, end] with the n given rows, moving the rows after
+// them only once
+void voided_replace_rows(const int start, const int end, const erow *rows, const int n){
+  if(start < 0 || end >= E.buf->numrows || start > end) return;
+  if(E.buf->lf.on){
+    voided_del_rows(start, end);
+    voided_insert_rows(start, rows, n);
+    return;
+  }
+  if(JOURNAL_ON()){
+    voided_journal_rec(J_DEL_ROWS, start, 0, NULL, end - start + 1);
+    int i;
+    for(i = 0; i < n; i++)
+      voided_journal_rec(J_INS_ROW, start + i, 0, rows[i].chars, rows[i].size);
+  }
+  E.buf->dirty++;
+
+  int r;
+  for(r = start; r <= end; r++){
+    voided_words_span(&E.buf->row[r], 0, E.buf->row[r].size, -1);
+    voided_free_row(&E.buf->row[r]);
+  }
+  for(r = 0; r < n; r++)
+    voided_words_span(&rows[r], 0, rows[r].size, 1);
+  int removed = end - start + 1;
+  int numrows = E.buf->numrows - removed + n;
+  if(n > removed) E.buf->row = realloc(E.buf->row, sizeof(erow) * numrows);
+  memmove(&E.buf->row[start + n], &E.buf->row[end + 1], sizeof(erow) * (E.buf->numrows - end - 1));
+  memcpy(&E.buf->row[start], rows, sizeof(erow) * n);
+  E.buf->numrows = numrows;
 }
 
 void voided_row_insert_char(erow *row, int at, const int c){
   if(at < 0 || at > row->size) at = row->size;
-  row->chars = realloc(row->chars, row->size + 2);
+  if(JOURNAL_ON()){
+    char ch = c;
+    voided_journal_rec(J_INS_CHAR, voided_row_index(row), at, &ch, 1);
+  }
+  voided_words_span(row, at, at, -1);
+  voided_row_reserve(row, row->size + 1);
   memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
   row->size++;
   row->chars[at] = c;
+  voided_words_span(row, at, at + 1, 1);
   voided_update_row(row);
-  E.dirty++;
+  voided_row_modified(row);
 }
 
 void voided_row_append_string(erow *row, const char *s, const size_t len){
-  row->chars = realloc (row->chars, row->size + len + 1);
+  if(JOURNAL_ON()) voided_journal_rec(J_INS_STR, voided_row_index(row), row->size, s, len);
+  int at = row->size;
+  voided_words_span(row, at, at, -1);
+  voided_row_reserve(row, row->size + len);
   memcpy(&row->chars[row->size], s, len);
   row->size += len;
   row->chars[row->size] = '\0';
+  voided_words_span(row, at, at + len, 1);
+  voided_update_row(row);
+  voided_row_modified(row);
+}
+
+// inserts s of size len into row at position at
+void voided_row_insert_string(erow *row, int at, const char *s, const size_t len){
+  if(at < 0 || at > row->size) at = row->size;
+  if(JOURNAL_ON()) voided_journal_rec(J_INS_STR, voided_row_index(row), at, s, len);
+  voided_words_span(row, at, at, -1);
+  voided_row_reserve(row, row->size + len);
+  memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+  memcpy(&row->chars[at], s, len);
+  row->size += len;
+  voided_words_span(row, at, at + len, 1);
   voided_update_row(row);
-  E.dirty++;
+  voided_row_modified(row);
+}
+
+// cuts row down to its first len bytes
+void voided_row_truncate(erow *row, const int len){
+  if(len < 0 || len >= row->size) return;
+  if(JOURNAL_ON()) voided_journal_rec(J_DEL_STR, voided_row_index(row), len, NULL, row->size - len);
+  voided_words_span(row, len, row->size, -1);
+  voided_row_reserve(row, len);
+  row->size = len;
+  row->chars[len] = '\0';
+  voided_words_span(row, len, len, 1);
+  voided_update_row(row);
+  voided_row_modified(row);
+}
+
+// deletes len bytes from row starting at position at
+void voided_row_del_string(erow *row, const int at, int len){
+  if(at < 0 || at >= row->size || len <= 0) return;
+  if(at + len > row->size) len = row->size - at;
+  if(JOURNAL_ON()) voided_journal_rec(J_DEL_STR, voided_row_index(row), at, NULL, len);
+  voided_words_span(row, at, at + len, -1);
+  voided_row_reserve(row, row->size);
+  memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+  row->size -= len;
+  voided_words_span(row, at, at, 1);
+  voided_update_row(row);
+  voided_row_modified(row);
 }
 
 void voided_row_del_char(erow *row, const int at){
   if(at < 0 || at >= row->size) return;
+  if(JOURNAL_ON()) voided_journal_rec(J_DEL_STR, voided_row_index(row), at, NULL, 1);
+  voided_words_span(row, at, at + 1, -1);
+  voided_row_reserve(row, row->size);
   memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
   row->size--;
+  voided_words_span(row, at, at, 1);
   voided_update_row(row);
-  E.dirty++;
+  voided_row_modified(row);
 }
 
 /*** editor operations ***/
 
 void voided_insert_char(const int c){
-  if(E.cy == E.numrows){
-    voided_insert_row(E.numrows, "", 0);
+  if(E.cy == E.buf->numrows){
+    voided_insert_row(E.buf->numrows, "", 0);
   }
-  voided_row_insert_char(&E.row[E.cy], E.cx, c);
+  voided_row_insert_char(voided_row(E.cy), E.cx, c);
   E.cx++;
 }
 
@@ -300,128 +807,3155 @@ void voided_insert_newline(){
   if(E.cx == 0){
     voided_insert_row(E.cy, "", 0);
   } else{
-    erow *row = &E.row[E.cy];
+    erow *row = voided_row(E.cy);
     voided_insert_row(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-    row = &E.row[E.cy];
-    row->size = E.cx;
-    row->chars[row->size] = '\0';
-    voided_update_row(row);
+    voided_row_truncate(voided_row(E.cy), E.cx);
   }
   E.cy++;
   E.cx = 0;
 }
 
-void voided_del_char(){
-  if(E.cy == E.numrows) return;
-  if(E.cx == 0 && E.cy == 0) return;
+void voided_del_char(){
+  if(E.cy == E.buf->numrows) return;
+  if(E.cx == 0 && E.cy == 0) return;
+
+  erow *row = voided_row(E.cy);
+  if(E.cx > 0){
+    voided_row_del_char(row, E.cx - 1);
+    E.cx--;
+  } else{
+    erow *prev = voided_row(E.cy - 1);
+    E.cx = prev->size;
+    voided_row_append_string(prev, row->chars, row->size);
+    voided_del_row(E.cy);
+    E.cy--;
+  }
+}
+
+/*** journal ***/
+
+#define JOURNAL_MAGIC "VOIDJRN1"
+
+// written at the start of every journal, to tell which version of the file
+// its records apply to
+struct journal_hdr{
+  char magic[8];
+  long long size;
+  long long mtime;
+};
+
+// writes all of buf to fd, retrying short writes
+int voided_write_all(const int fd, const char *buf, long len){
+  while(len > 0){
+    ssize_t n = write(fd, buf, len);
+    if(n == -1){
+      if(errno == EINTR) continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+void voided_journal_close(){
+  if(E.buf->jrn.fd == -1) return;
+  close(E.buf->jrn.fd);
+  E.buf->jrn.fd = -1;
+  free(E.buf->jrn.path);
+  E.buf->jrn.path = NULL;
+  E.buf->jrn.len = 0;
+}
+
+void voided_journal_write(const char *s, const long len){
+  if(voided_write_all(E.buf->jrn.fd, s, len) == -1){
+    voided_journal_close();
+    voided_set_status_msg("can't write recovery journal: %s", 1, strerror(errno));
+    return;
+  }
+  E.buf->jrn.unsynced = 1;
+}
+
+void voided_journal_flush(){
+  if(E.buf->jrn.fd == -1 || E.buf->jrn.len == 0) return;
+  int len = E.buf->jrn.len;
+  E.buf->jrn.len = 0;
+  voided_journal_write(E.buf->jrn.buf, len);
+}
+
+// flushes buffered records and fdatasync()s the journal every so often.
+// called while waiting for input
+void voided_journal_tick(){
+  voided_journal_flush();
+  if(E.buf->jrn.fd != -1 && E.buf->jrn.unsynced && time(NULL) - E.buf->jrn.synced >= VOID_JOURNAL_SYNC){
+    fdatasync(E.buf->jrn.fd);
+    E.buf->jrn.unsynced = 0;
+    E.buf->jrn.synced = time(NULL);
+  }
+}
+
+// ticks the journal of every buffer, shown or not
+void voided_journal_tick_all(){
+  struct ebuf *cur = E.buf;
+  int i;
+  for(i = 0; i < nbufs; i++){
+    E.buf = bufs[i];
+    voided_journal_tick();
+  }
+  E.buf = cur;
+}
+
+void voided_journal_put(const char *s, const long len){
+  if(E.buf->jrn.len + len > VOID_JOURNAL_BUF){
+    voided_journal_flush();
+    if(len > VOID_JOURNAL_BUF){
+      voided_journal_write(s, len);
+      return;
+    }
+  }
+  memcpy(&E.buf->jrn.buf[E.buf->jrn.len], s, len);
+  E.buf->jrn.len += len;
+}
+
+// numbers are stored as LEB128 varints, so row and column numbers mostly
+// take one to three bytes
+void voided_journal_num(unsigned long n){
+  char b[10];
+  int i = 0;
+  do{
+    b[i] = n & 0x7f;
+    n >>= 7;
+    if(n) b[i] |= 0x80;
+    i++;
+  } while(n);
+  voided_journal_put(b, i);
+}
+
+// appends one record. which of a, b, s and len get stored depends on op
+// (see enum JournalOp)
+void voided_journal_rec(const char op, const long a, const long b,
+                        const char *s, const long len){
+  if(E.buf->jrn.fd == -1) return;
+  voided_journal_put(&op, 1);
+  voided_journal_num(a);
+  switch(op){
+    case J_INS_CHAR:
+      voided_journal_num(b);
+      voided_journal_put(s, 1);
+      break;
+    case J_DEL_STR:
+      voided_journal_num(b);
+      voided_journal_num(len);
+      break;
+    case J_INS_STR:
+      voided_journal_num(b);
+      voided_journal_num(len);
+      voided_journal_put(s, len);
+      break;
+    case J_INS_ROW:
+    case J_SET_ROW:
+      voided_journal_num(len);
+      voided_journal_put(s, len);
+      break;
+    case J_DEL_ROWS:
+      voided_journal_num(len);
+      break;
+  }
+}
+
+// the journal for dir/name is dir/.name.vswp
+char *voided_journal_path(const char *filename){
+  const char *base = strrchr(filename, '/');
+  base = base ? base + 1 : filename;
+  int dirlen = base - filename;
+  char *path = malloc(dirlen + strlen(base) + 7);
+  sprintf(path, "%.*s.%s.vswp", dirlen, filename, base);
+  return path;
+}
+
+void voided_journal_hdr(struct journal_hdr *h){
+  struct stat st;
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, JOURNAL_MAGIC, sizeof(h->magic));
+  if(E.buf->filename && stat(E.buf->filename, &st) == 0){
+    h->size = st.st_size;
+    h->mtime = st.st_mtime;
+  }
+}
+
+// starts the journal over, against the file as it is on disk now
+void voided_journal_reset(){
+  if(E.buf->jrn.fd == -1 || E.buf->jrn.asking) return;
+  struct journal_hdr h;
+  voided_journal_hdr(&h);
+  E.buf->jrn.len = 0;
+  if(ftruncate(E.buf->jrn.fd, 0) == -1){
+    voided_journal_close();
+    return;
+  }
+  voided_journal_write((char *)&h, sizeof(h));
+  voided_journal_tick();
+}
+
+// reads a varint from *p, failing if it would run past end or doesn't fit
+// in a long
+int voided_journal_get_num(const char **p, const char *end, long *n){
+  unsigned long v = 0;
+  int shift = 0;
+  while(*p < end && shift < 64){
+    unsigned char b = *(*p)++;
+    // the tenth byte only has room for the top bit
+    if(shift == 63 && (b & 0x7f) > 1) return 0;
+    v |= (unsigned long)(b & 0x7f) << shift;
+    if(!(b & 0x80)){
+      if(v > LONG_MAX) return 0;
+      *n = v;
+      return 1;
+    }
+    shift += 7;
+  }
+  return 0;
+}
+
+// decodes and applies the record at *p. returns 0 if the record is cut
+// short, corrupt or doesn't fit the buffer, leaving *p where it was
+int voided_journal_apply(const char **p, const char *end){
+  const char *q = *p;
+  char op = *q++;
+  long a, b = 0, len = 0;
+  const char *s = NULL;
+
+  if(!voided_journal_get_num(&q, end, &a)) return 0;
+  if(op == J_INS_CHAR || op == J_DEL_STR || op == J_INS_STR){
+    if(!voided_journal_get_num(&q, end, &b)) return 0;
+  }
+  if(op == J_INS_CHAR){
+    len = 1;
+  } else if(!voided_journal_get_num(&q, end, &len)){
+    return 0;
+  }
+  // rows, columns and lengths all have to fit the int they end up in
+  if(a < 0 || b < 0 || len < 0 || a > INT_MAX || b > INT_MAX || len > INT_MAX) return 0;
+  if(op == J_INS_CHAR || op == J_DEL_STR || op == J_INS_STR){
+    if(a >= E.buf->numrows || b > voided_row(a)->size) return 0;
+  }
+  if(op == J_INS_CHAR || op == J_INS_STR || op == J_INS_ROW || op == J_SET_ROW){
+    if(len > end - q) return 0;
+    s = q;
+    q += len;
+  }
+
+  switch(op){
+    case J_INS_CHAR:
+      voided_row_insert_char(voided_row(a), b, *s);
+      break;
+    case J_DEL_STR:
+      voided_row_del_string(voided_row(a), b, len);
+      break;
+    case J_INS_STR:
+      voided_row_insert_string(voided_row(a), b, s, len);
+      break;
+    case J_INS_ROW:
+      if(a > E.buf->numrows) return 0;
+      voided_insert_row(a, s, len);
+      break;
+    case J_DEL_ROWS:
+      if(len < 1 || a + len > E.buf->numrows) return 0;
+      voided_del_rows(a, a + len - 1);
+      break;
+    case J_SET_ROW:
+      if(a >= E.buf->numrows) return 0;
+      voided_row_del_string(voided_row(a), 0, voided_row(a)->size);
+      voided_row_insert_string(voided_row(a), 0, s, len);
+      break;
+    default:
+      return 0;
+  }
+  *p = q;
+  return 1;
+}
+
+// replays the records in the journal onto the freshly loaded buffer.
+// anything after the last complete record is cut off the journal
+void voided_journal_replay(const long size){
+  char *buf = malloc(size);
+  if(pread(E.buf->jrn.fd, buf, size, 0) != size){
+    free(buf);
+    voided_set_status_msg("can't read recovery journal", 1);
+    return;
+  }
+  const char *p = buf + sizeof(struct journal_hdr);
+  const char *end = buf + size;
+  int nrec = 0;
+
+  E.buf->jrn.replaying = 1;
+  while(p < end && voided_journal_apply(&p, end)) nrec++;
+  E.buf->jrn.replaying = 0;
+
+  if(p < end){
+    if(ftruncate(E.buf->jrn.fd, p - buf) == -1) voided_journal_close();
+    voided_set_status_msg("recovered %d edits (journal was cut short)", 1, nrec);
+  } else{
+    voided_set_status_msg("recovered %d edits from '%s'", 1, nrec, E.buf->jrn.path);
+  }
+  free(buf);
+}
+
+// what the view said about replaying the journal left behind: "y", "n",
+// or NULL if it went away without saying. then the journal is left for
+// next time, and unless some other view needs the buffer it's unloaded so
+// that whoever shows it next is asked again
+void voided_journal_answer(char *answer){
+  E.buf->jrn.asking = 0;
+  if(answer == NULL){
+    voided_journal_close();
+    if(E.buf->views <= 1 && !E.buf->dirty) voided_buf_unload(E.buf);
+  } else if(answer[0] == 'y'){
+    struct stat st;
+    if(fstat(E.buf->jrn.fd, &st) == 0) voided_journal_replay(st.st_size);
+  } else{
+    voided_journal_reset();
+  }
+  free(answer);
+}
+
+// opens the journal for E.buf->filename. if one was left behind by a session
+// that died, offers to replay it when replay is set. edits aren't logged
+// until the answer is in
+void voided_journal_open(const char replay){
+  if(E.buf->filename == NULL || E.buf->jrn.fd != -1) return;
+
+  char *path = voided_journal_path(E.buf->filename);
+  int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if(fd == -1){
+    voided_set_status_msg("can't open recovery journal: %s", 1, strerror(errno));
+    free(path);
+    return;
+  }
+  E.buf->jrn.fd = fd;
+  E.buf->jrn.path = path;
+  E.buf->jrn.len = 0;
+  E.buf->jrn.unsynced = 0;
+  E.buf->jrn.synced = time(NULL);
+
+  struct stat st;
+  struct journal_hdr h, cur;
+  voided_journal_hdr(&cur);
+  if(replay && fstat(fd, &st) == 0 && st.st_size > (off_t)sizeof(h) &&
+     pread(fd, &h, sizeof(h), 0) == sizeof(h) &&
+     memcmp(h.magic, JOURNAL_MAGIC, sizeof(h.magic)) == 0){
+    const char *q = (h.size == cur.size && h.mtime == cur.mtime) ?
+      "found recovery journal for '%s', replay it? (y/n)" :
+      "found recovery journal for '%s' (file changed since), replay it? (y/n)";
+    E.buf->jrn.asking = 1;
+    voided_confirm(q, E.buf->filename, voided_journal_answer);
+    return;
+  }
+  voided_journal_reset();
+}
+
+// flushes and closes the journal on the way out. it is only kept if there
+// are unsaved changes
+void voided_journal_quit(){
+  if(E.buf->jrn.fd == -1) return;
+  voided_journal_flush();
+  if(E.buf->dirty || E.buf->jrn.asking){
+    fdatasync(E.buf->jrn.fd);
+  } else if(E.buf->jrn.path){
+    unlink(E.buf->jrn.path);
+  }
+  voided_journal_close();
+}
+
+/*** line indexing ***/
+
+// a chunk of text, made up of whole lines, split into rows by one thread
+struct index_job{
+  const char *start, *end;
+  erow *rows;
+  int nrows, cap;
+  pthread_t tid;
+};
+
+// adds the line from line up to eol (exclusive) to the job's rows,
+// dropping any carriage returns before the newline
+void voided_index_push(struct index_job *job, const char *line, const char *eol){
+  while(eol > line && eol[-1] == '\r') eol--;
+  if(job->nrows == job->cap){
+    job->cap = job->cap ? job->cap * 2 : 1024;
+    job->rows = realloc(job->rows, sizeof(erow) * job->cap);
+  }
+  erow *row = &job->rows[job->nrows++];
+  row->size = eol - line;
+  row->chars = voided_chars_new(line, row->size);
+  row->rsize = 0;
+  row->render = NULL;
+}
+
+// finds the newlines in the job's chunk and turns each line into a row as
+// it goes. with SSE2, 16 bytes are compared at once and the newlines are
+// picked out of the resulting bit mask
+void *voided_index_chunk(void *p){
+  struct index_job *job = p;
+  const char *line = job->start;
+  const char *s = job->start;
+  const char *e;
+
+#ifdef __SSE2__
+  const __m128i nl = _mm_set1_epi8('\n');
+  for(; s + 16 <= job->end; s += 16){
+    __m128i v = _mm_loadu_si128((const __m128i *)s);
+    unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    while(mask){
+      e = s + __builtin_ctz(mask);
+      voided_index_push(job, line, e);
+      line = e + 1;
+      mask &= mask - 1;
+    }
+  }
+#endif
+  while(s < job->end && (e = memchr(s, '\n', job->end - s)) != NULL){
+    voided_index_push(job, line, e);
+    line = s = e + 1;
+  }
+  // a last line without a newline is still a line
+  if(line < job->end) voided_index_push(job, line, job->end);
+  return NULL;
+}
+
+// splits len bytes of text into rows. big texts are cut into chunks at
+// line boundaries and indexed by several threads, then the per-chunk row
+// arrays are stitched together. render strings are left to be built
+// lazily. returns the number of rows put in *rows
+int voided_index_lines(const char *buf, const long len, erow **rows){
+  int nthreads = voided_ncpus();
+  if(len / VOID_PAR_BYTES < nthreads) nthreads = len / VOID_PAR_BYTES;
+  if(nthreads < 1) nthreads = 1;
+
+  struct index_job jobs[VOID_MAX_THREADS];
+  const char *end = buf + len;
+  const char *p = buf;
+  int i;
+  for(i = 0; i < nthreads; i++){
+    jobs[i].start = p;
+    if(i == nthreads - 1){
+      p = end;
+    } else{
+      p = buf + (len / nthreads) * (i + 1);
+      if(p < jobs[i].start) p = jobs[i].start;
+      const char *nl = memchr(p, '\n', end - p);
+      p = nl ? nl + 1 : end;
+    }
+    jobs[i].end = p;
+    jobs[i].rows = NULL;
+    jobs[i].nrows = jobs[i].cap = 0;
+  }
+
+  for(i = 1; i < nthreads; i++){
+    if(pthread_create(&jobs[i].tid, NULL, voided_index_chunk, &jobs[i]) != 0){
+      voided_index_chunk(&jobs[i]);
+      jobs[i].tid = 0;
+    }
+  }
+  voided_index_chunk(&jobs[0]);
+
+  int total = jobs[0].nrows;
+  for(i = 1; i < nthreads; i++){
+    if(jobs[i].tid) pthread_join(jobs[i].tid, NULL);
+    total += jobs[i].nrows;
+  }
+  if(nthreads == 1){
+    *rows = jobs[0].rows;
+    return total;
+  }
+
+  *rows = malloc(sizeof(erow) * (total ? total : 1));
+  int n = 0;
+  for(i = 0; i < nthreads; i++){
+    memcpy(&(*rows)[n], jobs[i].rows, sizeof(erow) * jobs[i].nrows);
+    n += jobs[i].nrows;
+    free(jobs[i].rows);
+  }
+  return total;
+}
+
+/*** file watching ***/
+
+// reads bytes [off, off + len) of fd into a new buffer
+char *voided_read_range(const int fd, const long off, const long len){
+  char *buf = malloc(len ? len : 1);
+  long got = 0;
+  while(got < len){
+    ssize_t n = pread(fd, buf + got, len - got, off + got);
+    if(n == -1 && errno == EINTR) continue;
+    if(n <= 0){
+      // a file cut short under us reads as end of file
+      if(n == 0) errno = EIO;
+      free(buf);
+      return NULL;
+    }
+    got += n;
+  }
+  return buf;
+}
+
+// reads fd from the start to its end, for files that can't be mapped or
+// don't know their size (like those in /proc). returns NULL (with errno
+// set) on error
+char *voided_read_fd(const int fd, long *len){
+  long cap = 65536, got = 0;
+  char *buf = malloc(cap);
+  while(1){
+    if(got == cap){
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+    ssize_t n = pread(fd, buf + got, cap - got, got);
+    if(n == -1 && errno == EINTR) continue;
+    if(n == -1){
+      free(buf);
+      return NULL;
+    }
+    if(n == 0) break;
+    got += n;
+  }
+  *len = got;
+  return buf;
+}
+
+// remembers that the buffer now reflects the first size bytes of the file
+void voided_watch_mark(const long size, const char partial){
+  struct stat st;
+  E.buf->watch.size = size;
+  E.buf->watch.partial = partial;
+  E.buf->watch.taillen = 0;
+  if(E.buf->filename == NULL || stat(E.buf->filename, &st) == -1) return;
+  E.buf->watch.ino = st.st_ino;
+  E.buf->watch.mtime = st.st_mtim;
+
+  int fd = open(E.buf->filename, O_RDONLY | O_CLOEXEC);
+  if(fd == -1) return;
+  int n = size < VOID_WATCH_TAIL ? size : VOID_WATCH_TAIL;
+  if(pread(fd, E.buf->watch.tail, n, size - n) == n) E.buf->watch.taillen = n;
+  close(fd);
+}
+
+// reads what was appended to the file since it was loaded and adds it to
+// the end of the buffer with a single row insertion
+void voided_watch_append(const int fd, const long newsize){
+  char *buf = voided_read_range(fd, E.buf->watch.size, newsize - E.buf->watch.size);
+  if(buf == NULL) return;
+  const char *p = buf;
+  long len = newsize - E.buf->watch.size;
+  char partial = E.buf->watch.partial;
+
+  // the first new bytes finish off the old last line if it had no newline
+  if(E.buf->watch.partial && E.buf->numrows > 0){
+    const char *nl = memchr(p, '\n', len);
+    long linelen = (nl ? nl : p + len) - p;
+    long keep = linelen;
+    while(keep > 0 && p[keep - 1] == '\r') keep--;
+    voided_row_append_string(voided_row(E.buf->numrows - 1), p, keep);
+    p += nl ? linelen + 1 : linelen;
+    len -= nl ? linelen + 1 : linelen;
+    partial = (nl == NULL);
+  }
+
+  erow *rows;
+  int n = voided_index_lines(p, len, &rows);
+  voided_insert_rows(E.buf->numrows, rows, n);
+  free(rows);
+  if(len > 0) partial = p[len - 1] != '\n';
+  free(buf);
+  voided_watch_mark(newsize, partial);
+}
+
+int voided_row_equal(const erow *a, const erow *b){
+  return a->size == b->size && memcmp(a->chars, b->chars, a->size) == 0;
+}
+
+// reloads a file that changed somewhere other than its end: rows that are
+// the same at the start and the end of the buffer are kept, only the part
+// in between is replaced
+void voided_watch_rewrite(const int fd, const long newsize){
+  char *buf = voided_read_range(fd, 0, newsize);
+  if(buf == NULL) return;
+  erow *rows;
+  int n = voided_index_lines(buf, newsize, &rows);
+  char partial = newsize > 0 && buf[newsize - 1] != '\n';
+  free(buf);
+
+  int pre = 0, suf = 0;
+  while(pre < n && pre < E.buf->numrows && voided_row_equal(&rows[pre], voided_row(pre)))
+    pre++;
+  while(suf < n - pre && suf < E.buf->numrows - pre &&
+        voided_row_equal(&rows[n - 1 - suf], voided_row(E.buf->numrows - 1 - suf)))
+    suf++;
+
+  int i;
+  for(i = 0; i < pre; i++) voided_free_row(&rows[i]);
+  for(i = n - suf; i < n; i++) voided_free_row(&rows[i]);
+  if(E.buf->numrows - suf > pre) voided_del_rows(pre, E.buf->numrows - suf - 1);
+  voided_insert_rows(pre, &rows[pre], n - suf - pre);
+  free(rows);
+  voided_watch_mark(newsize, partial);
+}
+
+// looks at the file on disk and brings the buffer up to date with it.
+// returns 1 if the buffer changed
+int voided_watch_reload(){
+  int fd = open(E.buf->filename, O_RDONLY | O_CLOEXEC);
+  if(fd == -1) return 0;
+  struct stat st;
+  if(fstat(fd, &st) == -1){
+    close(fd);
+    return 0;
+  }
+
+  // the file is taken to have only been appended to if it is still the
+  // same inode, grew and still ends (up to the old size) with the bytes it
+  // ended with before. anything else, including a write in place that kept
+  // the size, goes through a full rewrite
+  char same = st.st_ino == E.buf->watch.ino && st.st_size == E.buf->watch.size &&
+              st.st_mtim.tv_sec == E.buf->watch.mtime.tv_sec &&
+              st.st_mtim.tv_nsec == E.buf->watch.mtime.tv_nsec;
+  if(same){
+    close(fd);
+    return 0;
+  }
+  char append = st.st_ino == E.buf->watch.ino && st.st_size > E.buf->watch.size;
+  if(append && E.buf->watch.taillen > 0){
+    char tail[VOID_WATCH_TAIL];
+    int n = E.buf->watch.taillen;
+    append = pread(fd, tail, n, E.buf->watch.size - n) == n &&
+             memcmp(tail, E.buf->watch.tail, n) == 0;
+  }
+  if(E.buf->dirty){
+    close(fd);
+    voided_set_status_msg("'%s' changed on disk, not reloading a modified buffer", 1, E.buf->filename);
+    return 0;
+  }
+
+  int oldrows = E.buf->numrows;
+  char follow = E.cy >= E.buf->numrows - 1;
+  // changes read from disk aren't edits, so they stay out of the journal
+  int jfd = E.buf->jrn.fd;
+  E.buf->jrn.fd = -1;
+  if(append) voided_watch_append(fd, st.st_size);
+  else voided_watch_rewrite(fd, st.st_size);
+  E.buf->jrn.fd = jfd;
+  close(fd);
+
+  E.buf->dirty = 0;
+  voided_journal_reset();
+  if(follow && E.buf->numrows > oldrows){
+    E.cy = E.buf->numrows - 1;
+    E.cx = 0;
+  }
+  // the row under the cursor may have been replaced by a shorter one
+  if(E.cy > E.buf->numrows) E.cy = E.buf->numrows;
+  int rowlen = E.cy < E.buf->numrows ? voided_row(E.cy)->size : 0;
+  if(E.cx > rowlen) E.cx = rowlen;
+  return 1;
+}
+
+void voided_watch_stop(){
+  if(E.buf->watch.fd == -1) return;
+  close(E.buf->watch.fd);
+  E.buf->watch.fd = -1;
+}
+
+// turns ':watch' mode on or off. while it is on, the buffer follows changes
+// other programs make to the file, and the view sticks to the end of the
+// file like 'tail -f' as long as the cursor is on the last row
+void voided_watch_toggle(){
+  if(E.buf->lf.on){
+    voided_set_status_msg("can't watch files in large file mode", 1);
+    return;
+  }
+  if(E.buf->watch.fd != -1){
+    voided_watch_stop();
+    voided_set_status_msg("stopped watching '%s'", 1, E.buf->filename);
+    return;
+  }
+  if(E.buf->filename == NULL){
+    voided_set_status_msg("no file to watch", 1);
+    return;
+  }
+  E.buf->watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if(E.buf->watch.fd == -1 ||
+     (E.buf->watch.wd = inotify_add_watch(E.buf->watch.fd, E.buf->filename,
+       IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)) == -1){
+    voided_set_status_msg("can't watch '%s': %s", 1, E.buf->filename, strerror(errno));
+    voided_watch_stop();
+    return;
+  }
+  voided_watch_reload();
+  E.cy = E.buf->numrows > 0 ? E.buf->numrows - 1 : 0;
+  E.cx = 0;
+  voided_set_status_msg("watching '%s'", 1, E.buf->filename);
+}
+
+// drains pending inotify events. returns 1 if the buffer was reloaded
+int voided_watch_tick(){
+  if(E.buf->watch.fd == -1) return 0;
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  int events = 0, moved = 0;
+  ssize_t n;
+  while((n = read(E.buf->watch.fd, buf, sizeof(buf))) > 0){
+    char *p;
+    for(p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len){
+      struct inotify_event *ev = (struct inotify_event *)p;
+      if(ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) moved = 1;
+      events++;
+    }
+  }
+  if(events == 0) return 0;
+
+  // the file was replaced (e.g. saved by another editor): watch the new one
+  if(moved){
+    inotify_rm_watch(E.buf->watch.fd, E.buf->watch.wd);
+    E.buf->watch.wd = inotify_add_watch(E.buf->watch.fd, E.buf->filename,
+      IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+  }
+  return voided_watch_reload();
+}
+
+/*** compression ***/
+
+// a small LZ77 codec for evicted blocks. the output is a run of sequences,
+// each made of a varint literal count, the literals, then a varint match
+// length (minus 4) and a 16-bit offset back into the output. the last
+// sequence stops after its literals
+
+// the most bytes len bytes can compress to
+long voided_lz_bound(const long len){
+  return len + len / 64 + 16;
+}
+
+int voided_lz_num(char *dst, unsigned long n){
+  int i = 0;
+  do{
+    dst[i] = n & 0x7f;
+    n >>= 7;
+    if(n) dst[i] |= 0x80;
+    i++;
+  } while(n);
+  return i;
+}
+
+// compresses len bytes of src into dst, which must hold
+// voided_lz_bound(len) bytes. returns the compressed size
+long voided_lz_compress(const char *src, const long len, char *dst){
+  const unsigned char *s = (const unsigned char *)src;
+  unsigned int *table = calloc(1 << VOID_LZ_HASH, sizeof(unsigned int));
+  long ip = 0, anchor = 0, op = 0;
+
+  while(ip + 4 <= len){
+    unsigned int seq;
+    memcpy(&seq, s + ip, 4);
+    unsigned int h = (seq * 2654435761u) >> (32 - VOID_LZ_HASH);
+    long ref = (long)table[h] - 1;
+    table[h] = ip + 1;
+    if(ref < 0 || ip - ref > 0xffff || memcmp(s + ref, s + ip, 4) != 0){
+      // step faster through data that doesn't compress
+      ip += 1 + ((ip - anchor) >> 6);
+      continue;
+    }
+    long ml = 4;
+    while(ip + ml < len && s[ref + ml] == s[ip + ml]) ml++;
+
+    op += voided_lz_num(dst + op, ip - anchor);
+    memcpy(dst + op, src + anchor, ip - anchor);
+    op += ip - anchor;
+    op += voided_lz_num(dst + op, ml - 4);
+    dst[op++] = (ip - ref) & 0xff;
+    dst[op++] = (ip - ref) >> 8;
+    ip += ml;
+    anchor = ip;
+  }
+  op += voided_lz_num(dst + op, len - anchor);
+  memcpy(dst + op, src + anchor, len - anchor);
+  op += len - anchor;
+  free(table);
+  return op;
+}
+
+// expands zlen bytes of src into dst, which holds len bytes. returns -1
+// unless that gives exactly len bytes
+int voided_lz_decompress(const char *src, const long zlen, char *dst, const long len){
+  const char *ip = src, *iend = src + zlen;
+  long op = 0, n;
+  while(ip < iend){
+    if(!voided_journal_get_num(&ip, iend, &n) || n > iend - ip || n > len - op) return -1;
+    memcpy(dst + op, ip, n);
+    ip += n;
+    op += n;
+    if(ip == iend) break;
+
+    if(!voided_journal_get_num(&ip, iend, &n) || iend - ip < 2) return -1;
+    long ml = n + 4;
+    long off = (unsigned char)ip[0] | ((unsigned char)ip[1] << 8);
+    ip += 2;
+    if(off == 0 || off > op || ml > len - op) return -1;
+    if(off >= ml){
+      memcpy(dst + op, dst + op - off, ml);
+      op += ml;
+    } else{
+      // the match runs into itself: copy a byte at a time
+      while(ml--){
+        dst[op] = dst[op - off];
+        op++;
+      }
+    }
+  }
+  return op == len ? 0 : -1;
+}
+
+/*** large files ***/
+
+// the block that holds row at
+int voided_lf_block(const int at){
+  struct lfile *lf = &E.buf->lf;
+  struct lblock *blk = &lf->blocks[lf->last];
+  if(lf->last < lf->nblocks && blk->first <= at && at < blk->first + blk->nrows)
+    return lf->last;
+
+  // the last block starting at or before at. empty blocks share their
+  // first row with the next one, so they are never picked
+  int lo = 0, hi = lf->nblocks - 1;
+  while(lo < hi){
+    int mid = (lo + hi + 1) / 2;
+    if(lf->blocks[mid].first <= at) lo = mid;
+    else hi = mid - 1;
+  }
+  return lo;
+}
+
+// the loaded block whose rows contain row, if any
+struct lblock *voided_lf_owner(const erow *row){
+  struct lfile *lf = &E.buf->lf;
+  struct lblock *blk = &lf->blocks[lf->last];
+  if(blk->loaded && row >= blk->rows && row < blk->rows + blk->nrows) return blk;
+  int i;
+  for(i = 0; i < lf->nloaded; i++){
+    blk = &lf->blocks[lf->loaded[i]];
+    if(row >= blk->rows && row < blk->rows + blk->nrows) return blk;
+  }
+  return NULL;
+}
+
+// the rows of a loaded block as text, each one followed by a newline
+char *voided_lf_text(const struct lblock *blk, long *len){
+  long raw = 0;
+  int r;
+  for(r = 0; r < blk->nrows; r++)
+    raw += blk->rows[r].size + 1;
+  char *buf = malloc(raw ? raw : 1);
+  char *p = buf;
+  for(r = 0; r < blk->nrows; r++){
+    memcpy(p, blk->rows[r].chars, blk->rows[r].size);
+    p += blk->rows[r].size;
+    *p++ = '\n';
+  }
+  *len = raw;
+  return buf;
+}
+
+// writes len bytes for blk to the spill file, over the room it had there
+// the last time it was evicted if that's still enough. the file is made
+// the first time it's needed and unlinked straight away
+int voided_lf_spill(struct lblock *blk, const char *buf, const long len){
+  struct lfile *lf = &E.buf->lf;
+  if(lf->spill == -1){
+    const char *dir = getenv("TMPDIR");
+    if(dir == NULL || *dir == '\0') dir = "/tmp";
+    char *path = malloc(strlen(dir) + 16);
+    sprintf(path, "%s/voided.XXXXXX", dir);
+    lf->spill = mkostemp(path, O_CLOEXEC);
+    if(lf->spill != -1) unlink(path);
+    free(path);
+    if(lf->spill == -1) return -1;
+    lf->spillend = 0;
+  }
+  if(blk->spillcap < len){
+    blk->spill = lf->spillend;
+    blk->spillcap = len;
+    lf->spillend += len;
+  }
+  long done = 0;
+  while(done < len){
+    ssize_t n = pwrite(lf->spill, buf + done, len - done, blk->spill + done);
+    if(n == -1 && errno == EINTR) continue;
+    if(n <= 0) return -1;
+    done += n;
+  }
+  return 0;
+}
+
+// keeps a copy of an edited block's rows for when it's evicted: compressed
+// in memory with -z, otherwise as they are in the spill file
+int voided_lf_pack(struct lblock *blk){
+  struct lfile *lf = &E.buf->lf;
+  long raw;
+  char *buf = voided_lf_text(blk, &raw);
+  blk->zraw = raw;
+  blk->zip = lf->compress;
+  if(!blk->zip){
+    blk->zlen = raw;
+    int err = voided_lf_spill(blk, buf, raw);
+    free(buf);
+    return err;
+  }
+  char *z = malloc(voided_lz_bound(raw));
+  blk->zlen = voided_lz_compress(buf, raw, z);
+  blk->z = realloc(z, blk->zlen ? blk->zlen : 1);
+  free(buf);
+  lf->zlen += blk->zlen;
+  lf->zraw += blk->zraw;
+  return 0;
+}
+
+// reads back an evicted block's copy of its rows. the caller frees the
+// result. returns NULL (with errno set) if the copy can't be read
+char *voided_lf_unpack(struct lblock *blk){
+  struct lfile *lf = &E.buf->lf;
+  char *z = blk->z;
+  if(z == NULL && blk->zlen > 0){
+    z = voided_read_range(lf->spill, blk->spill, blk->zlen);
+    if(z == NULL) return NULL;
+  }
+  if(!blk->zip){
+    if(z == NULL || z == blk->z){
+      char *buf = malloc(blk->zraw ? blk->zraw : 1);
+      if(blk->zraw) memcpy(buf, z, blk->zraw);
+      return buf;
+    }
+    return z;
+  }
+  char *buf = malloc(blk->zraw ? blk->zraw : 1);
+  int err = voided_lz_decompress(z, blk->zlen, buf, blk->zraw);
+  if(z != blk->z) free(z);
+  if(err == -1){
+    free(buf);
+    errno = EIO;
+    return NULL;
+  }
+  return buf;
+}
+
+// moves the compressed copy of an evicted block out to the spill file, to
+// make room in the budget
+int voided_lf_stow(struct lblock *blk){
+  struct lfile *lf = &E.buf->lf;
+  if(voided_lf_spill(blk, blk->z, blk->zlen) == -1) return -1;
+  lf->zlen -= blk->zlen;
+  lf->zraw -= blk->zraw;
+  free(blk->z);
+  blk->z = NULL;
+  return 0;
+}
+
+// frees the copy of an evicted block kept in memory, if there is one
+void voided_lf_unpacked(struct lblock *blk){
+  struct lfile *lf = &E.buf->lf;
+  if(blk->z){
+    lf->zlen -= blk->zlen;
+    lf->zraw -= blk->zraw;
+    free(blk->z);
+    blk->z = NULL;
+  }
+  blk->zlen = blk->zraw = 0;
+}
+
+// what a loaded block's rows take up: their text, about as much again for
+// render strings, and the row structs themselves
+long voided_lf_cost(const struct lblock *blk){
+  long cost = (long)blk->nrows * (sizeof(erow) + 2 * sizeof(chars_hdr));
+  int r;
+  for(r = 0; r < blk->nrows; r++)
+    cost += 2 * (blk->rows[r].size + 1);
+  return cost;
+}
+
+// evicts the i-th loaded block. returns -1 if an edited block couldn't be
+// put aside, in which case it stays loaded
+int voided_lf_unload(const int i){
+  struct lfile *lf = &E.buf->lf;
+  struct lblock *blk = &lf->blocks[lf->loaded[i]];
+  // the file still has what a clean block holds, so it's just dropped
+  if(blk->dirty && voided_lf_pack(blk) == -1) return -1;
+  int r;
+  for(r = 0; r < blk->nrows; r++)
+    voided_free_row(&blk->rows[r]);
+  free(blk->rows);
+  blk->rows = NULL;
+  blk->loaded = 0;
+  lf->resident -= blk->cost;
+  lf->loaded[i] = lf->loaded[--lf->nloaded];
+  return 0;
+}
+
+// brings the cost of blocks edited since the last call up to date, then
+// unloads blocks, least recently used first, until the loaded rows and the
+// compressed copies fit in the budget again. copies get at most half of
+// it: past that, or once nothing more can be unloaded, the oldest ones are
+// moved to the spill file. the VOID_LF_PIN blocks used last are left alone
+// so that row pointers callers are still holding stay valid
+void voided_lf_evict(){
+  struct lfile *lf = &E.buf->lf;
+  int i;
+  for(i = 0; i < lf->nloaded; i++){
+    struct lblock *blk = &lf->blocks[lf->loaded[i]];
+    if(!blk->stale) continue;
+    lf->resident -= blk->cost;
+    blk->cost = voided_lf_cost(blk);
+    lf->resident += blk->cost;
+    blk->stale = 0;
+  }
+  while(lf->resident + lf->zlen > lf->budget){
+    int victim = -1, copy = -1;
+    for(i = 0; i < lf->nloaded; i++){
+      struct lblock *blk = &lf->blocks[lf->loaded[i]];
+      if(blk->used + VOID_LF_PIN > lf->clock) continue;
+      if(victim == -1 || blk->used < lf->blocks[lf->loaded[victim]].used) victim = i;
+    }
+    for(i = 0; (victim == -1 || lf->zlen > lf->budget / 2) && i < lf->nblocks; i++){
+      struct lblock *blk = &lf->blocks[i];
+      if(blk->z == NULL) continue;
+      if(copy == -1 || blk->used < lf->blocks[copy].used) copy = i;
+    }
+    if(copy != -1){
+      if(voided_lf_stow(&lf->blocks[copy]) == -1){
+        voided_set_status_msg("can't spill edited rows: %s", 1, strerror(errno));
+        return;
+      }
+      continue;
+    }
+    if(victim == -1) return;
+    if(voided_lf_unload(victim) == -1){
+      voided_set_status_msg("can't spill edited rows: %s", 1, strerror(errno));
+      return;
+    }
+  }
+}
+
+// a block couldn't be read back, and comes in as empty rows. the buffer
+// won't be saved over its file from here on, as that would lose them
+void voided_lf_lost(const struct lblock *blk){
+  E.buf->lf.broken = 1;
+  voided_set_status_msg("can't read lines %d-%d back (%s), saving is off", 1,
+                        blk->first + 1, blk->first + blk->nrows, strerror(errno));
+}
+
+// makes sure block b is in memory and marks it as used
+struct lblock *voided_lf_load(const int b){
+  struct lfile *lf = &E.buf->lf;
+  struct lblock *blk = &lf->blocks[b];
+  if(b != lf->last){
+    lf->clock++;
+    lf->last = b;
+  }
+  blk->used = lf->clock;
+  if(blk->loaded) return blk;
+
+  if(blk->z || blk->dirty){
+    char *buf = voided_lf_unpack(blk);
+    if(buf == NULL) voided_lf_lost(blk);
+    blk->rows = malloc(sizeof(erow) * (blk->nrows ? blk->nrows : 1));
+    // rows are split on every newline: carriage returns the rows held
+    // when they were compressed stay
+    const char *line = buf;
+    int r;
+    for(r = 0; r < blk->nrows; r++){
+      const char *eol = buf ? memchr(line, '\n', buf + blk->zraw - line) : line;
+      erow row = {eol - line, 0, voided_chars_new(line, eol - line), NULL};
+      blk->rows[r] = row;
+      line = eol + 1;
+    }
+    free(buf);
+    voided_lf_unpacked(blk);
+
+    blk->loaded = 1;
+    blk->cost = voided_lf_cost(blk);
+    lf->resident += blk->cost;
+    lf->loaded[lf->nloaded++] = b;
+    voided_lf_evict();
+    return blk;
+  }
+
+  char *buf = voided_read_range(lf->fd, blk->off, blk->len);
+  int n = 0;
+  blk->rows = NULL;
+  if(buf == NULL){
+    voided_lf_lost(blk);
+  } else{
+    n = voided_index_lines(buf, blk->len, &blk->rows);
+    free(buf);
+  }
+
+  // the file changed under us, or can't be read: keep the row count the
+  // table expects
+  int i;
+  if(n != blk->nrows) blk->rows = realloc(blk->rows, sizeof(erow) * (blk->nrows ? blk->nrows : 1));
+  for(i = n; i < blk->nrows; i++){
+    erow empty = {0, 0, voided_chars_new("", 0), NULL};
+    blk->rows[i] = empty;
+  }
+  for(i = blk->nrows; i < n; i++)
+    voided_free_row(&blk->rows[i]);
+
+  blk->loaded = 1;
+  blk->cost = voided_lf_cost(blk);
+  lf->resident += blk->cost;
+  lf->loaded[lf->nloaded++] = b;
+  voided_lf_evict();
+  return blk;
+}
+
+erow *voided_lf_row(const int at){
+  struct lblock *blk = voided_lf_load(voided_lf_block(at));
+  return &blk->rows[at - blk->first];
+}
+
+// fixes up the first row of every block from b on, after b changed size
+void voided_lf_renumber(int b){
+  struct lfile *lf = &E.buf->lf;
+  for(; b < lf->nblocks; b++)
+    lf->blocks[b].first = b ? lf->blocks[b - 1].first + lf->blocks[b - 1].nrows : 0;
+}
+
+// splits block b into blocks of VOID_LF_LINES rows once inserts have made
+// it too big to be evicted and read back in one go. the new blocks are the
+// first to be evicted
+void voided_lf_split(const int b){
+  struct lfile *lf = &E.buf->lf;
+  if(lf->blocks[b].nrows <= 2 * VOID_LF_LINES) return;
+  int extra = (lf->blocks[b].nrows - 1) / VOID_LF_LINES;
+  int total = lf->nblocks + extra;
+  lf->blocks = realloc(lf->blocks, sizeof(struct lblock) * (total / 1024 + 1) * 1024);
+  lf->loaded = realloc(lf->loaded, sizeof(int) * total);
+  memmove(&lf->blocks[b + 1 + extra], &lf->blocks[b + 1],
+          sizeof(struct lblock) * (lf->nblocks - b - 1));
+  int i;
+  for(i = 0; i < lf->nloaded; i++)
+    if(lf->loaded[i] > b) lf->loaded[i] += extra;
+  if(lf->last > b) lf->last += extra;
+  lf->nblocks = total;
+
+  struct lblock *blk = &lf->blocks[b];
+  erow *rows = blk->rows;
+  for(i = 1; i <= extra; i++){
+    struct lblock *nb = &blk[i];
+    memset(nb, 0, sizeof(*nb));
+    nb->off = blk->off + blk->len;
+    nb->nrows = i < extra ? VOID_LF_LINES : blk->nrows - extra * VOID_LF_LINES;
+    nb->rows = malloc(sizeof(erow) * nb->nrows);
+    memcpy(nb->rows, &rows[i * VOID_LF_LINES], sizeof(erow) * nb->nrows);
+    nb->loaded = nb->dirty = nb->stale = 1;
+    lf->loaded[lf->nloaded++] = b + i;
+  }
+  blk->nrows = VOID_LF_LINES;
+  blk->rows = realloc(rows, sizeof(erow) * VOID_LF_LINES);
+  blk->stale = 1;
+}
+
+// splices rows in at row at. they all go into the block that holds at,
+// which is split up if it gets too big
+void voided_lf_insert_rows(const int at, const erow *rows, const int n){
+  int b = voided_lf_block(at);
+  struct lblock *blk = voided_lf_load(b);
+  int i = at - blk->first;
+
+  blk->rows = realloc(blk->rows, sizeof(erow) * (blk->nrows + n));
+  memmove(&blk->rows[i + n], &blk->rows[i], sizeof(erow) * (blk->nrows - i));
+  memcpy(&blk->rows[i], rows, sizeof(erow) * n);
+  blk->nrows += n;
+  blk->dirty = blk->stale = 1;
+
+  E.buf->numrows += n;
+  voided_lf_split(b);
+  voided_lf_renumber(b + 1);
+  voided_lf_evict();
+}
+
+// deletes rows [start, end], which may run over several blocks
+void voided_lf_del_rows(const int start, const int end){
+  int b = voided_lf_block(start);
+  int left = end - start + 1;
+  int i = start - E.buf->lf.blocks[b].first;
+  int first = b;
+
+  while(left > 0 && b < E.buf->lf.nblocks){
+    struct lblock *blk = &E.buf->lf.blocks[b];
+    int k = blk->nrows - i < left ? blk->nrows - i : left;
+    if(k == blk->nrows && !blk->loaded){
+      // a block that goes entirely isn't read in just to be emptied, not
+      // even for its words. they stay counted until the file is saved
+      voided_lf_unpacked(blk);
+      blk->zip = 0;
+      if(E.buf->words.on) E.buf->words.stale = 1;
+    } else{
+      blk = voided_lf_load(b);
+      int r;
+      for(r = i; r < i + k; r++){
+        voided_words_span(&blk->rows[r], 0, blk->rows[r].size, -1);
+        voided_free_row(&blk->rows[r]);
+      }
+      memmove(&blk->rows[i], &blk->rows[i + k], sizeof(erow) * (blk->nrows - i - k));
+      blk->stale = 1;
+    }
+    blk->nrows -= k;
+    blk->dirty = 1;
+    left -= k;
+    E.buf->numrows -= k;
+    i = 0;
+    b++;
+  }
+  voided_lf_renumber(first + 1);
+  voided_lf_evict();
+}
+
+// ends the block being built at file offset end, with nrows rows in it.
+// returns -1 once the next block could take the row count past INT_MAX
+int voided_lf_checkpoint(const long end, const int nrows){
+  struct lfile *lf = &E.buf->lf;
+  struct lblock *blk = &lf->blocks[lf->nblocks - 1];
+  blk->len = end - blk->off;
+  blk->nrows = nrows;
+  E.buf->numrows += nrows;
+  if(E.buf->numrows > INT_MAX - 2 * VOID_LF_LINES) return -1;
+
+  if(lf->nblocks % 1024 == 0)
+    lf->blocks = realloc(lf->blocks, sizeof(struct lblock) * (lf->nblocks + 1024));
+  blk = &lf->blocks[lf->nblocks++];
+  memset(blk, 0, sizeof(*blk));
+  blk->off = end;
+  blk->first = E.buf->numrows;
+  return 0;
+}
+
+// builds the checkpoint table by streaming the whole file through a fixed
+// buffer once. newlines are counted 16 bytes at a time and only looked at
+// one by one in the words where a checkpoint falls
+int voided_lf_index(const long size){
+  struct lfile *lf = &E.buf->lf;
+  char *buf = malloc(VOID_LF_IO);
+  long off = 0;
+  int inblock = 0;
+  ssize_t n;
+
+  lf->blocks = malloc(sizeof(struct lblock) * 1024);
+  lf->nblocks = 1;
+  memset(lf->blocks, 0, sizeof(struct lblock));
+
+  while(off < size && (n = pread(lf->fd, buf, VOID_LF_IO, off)) > 0){
+    const char *s = buf, *end = buf + n, *e;
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    for(; s + 16 <= end; s += 16){
+      __m128i v = _mm_loadu_si128((const __m128i *)s);
+      unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+      int c = __builtin_popcount(mask);
+      if(inblock + c < VOID_LF_LINES){
+        inblock += c;
+        continue;
+      }
+      while(mask){
+        e = s + __builtin_ctz(mask);
+        mask &= mask - 1;
+        if(++inblock == VOID_LF_LINES){
+          if(voided_lf_checkpoint(off + (e - buf) + 1, inblock) == -1) goto toobig;
+          inblock = 0;
+        }
+      }
+    }
+#endif
+    while(s < end && (e = memchr(s, '\n', end - s)) != NULL){
+      if(++inblock == VOID_LF_LINES){
+        if(voided_lf_checkpoint(off + (e - buf) + 1, inblock) == -1) goto toobig;
+        inblock = 0;
+      }
+      s = e + 1;
+    }
+    off += n;
+  }
+  free(buf);
+
+  // whatever follows the last newline is one more row
+  struct lblock *last = &lf->blocks[lf->nblocks - 1];
+  if(size > last->off){
+    char c;
+    if(pread(lf->fd, &c, 1, size - 1) == 1 && c != '\n') inblock++;
+  }
+  last->len = size - last->off;
+  last->nrows = inblock;
+  E.buf->numrows += inblock;
+  if(last->len == 0 && lf->nblocks > 1) lf->nblocks--;
+  return 0;
+
+toobig:
+  free(buf);
+  return -1;
+}
+
+// opens filename (already open as fd) in large file mode. returns -1 with
+// errno set, and the buffer left as it was, if it has too many lines
+int voided_lf_open(const int fd, const long size, const char compress){
+  struct lfile *lf = &E.buf->lf;
+  lf->on = 1;
+  lf->fd = fd;
+  lf->compress = compress;
+  voided_set_status_msg("indexing '%s'...", 0, E.buf->filename);
+  voided_refresh_screen();
+  if(voided_lf_index(size) == -1){
+    free(lf->blocks);
+    memset(lf, 0, sizeof(*lf));
+    lf->fd = -1;
+    lf->spill = -1;
+    E.buf->numrows = 0;
+    errno = EFBIG;
+    return -1;
+  }
+  lf->loaded = malloc(sizeof(int) * lf->nblocks);
+  lf->nloaded = 0;
+  lf->last = 0;
+  voided_set_status_msg("large file mode: %d lines, %ld MB budget", 1,
+                        E.buf->numrows, lf->budget >> 20);
+  return 0;
+}
+
+// writes len bytes from buf through the save buffer
+int voided_lf_write(const int fd, char *wbuf, long *wlen, const char *s, long len){
+  if(*wlen + len > VOID_LF_IO){
+    if(voided_write_all(fd, wbuf, *wlen) == -1) return -1;
+    *wlen = 0;
+  }
+  if(len > VOID_LF_IO) return voided_write_all(fd, s, len);
+  memcpy(&wbuf[*wlen], s, len);
+  *wlen += len;
+  return 0;
+}
+
+// saves a large file: clean blocks are copied straight from the old file,
+// edited ones are written from their rows, into a new file that then
+// replaces the old one. returns the number of bytes written, or -1
+long voided_lf_save(){
+  struct lfile *lf = &E.buf->lf;
+  if(lf->broken){
+    errno = EIO;
+    return -1;
+  }
+  // a symlink is followed, so it's the file it points to that gets
+  // replaced. the new file is made next to that one, to be renamed over it
+  char *path = realpath(E.buf->filename, NULL);
+  if(path == NULL && errno != ENOENT) return -1;
+  if(path == NULL) path = strdup(E.buf->filename);
+  char *tmp = malloc(strlen(path) + 8);
+  sprintf(tmp, "%s.XXXXXX", path);
+  int fd = mkostemp(tmp, O_CLOEXEC);
+  if(fd == -1){
+    free(tmp);
+    free(path);
+    return -1;
+  }
+  // the new file takes the old one's mode and, where we're allowed to
+  // give it away, its owner
+  struct stat st;
+  if(fstat(lf->fd, &st) == 0){
+    if(fchown(fd, st.st_uid, st.st_gid) == -1 && errno != EPERM){
+      close(fd);
+      unlink(tmp);
+      free(tmp);
+      free(path);
+      return -1;
+    }
+    fchmod(fd, st.st_mode & 07777);
+  }
+
+  char *wbuf = malloc(VOID_LF_IO);
+  long wlen = 0, off = 0;
+  long *newoff = malloc(sizeof(long) * lf->nblocks);
+  int err = 0;
+  int b;
+  for(b = 0; b < lf->nblocks && !err; b++){
+    struct lblock *blk = &lf->blocks[b];
+    newoff[b] = off;
+    if(blk->dirty && !blk->loaded){
+      // an edited block that was evicted is written from its copy
+      char *buf = voided_lf_unpack(blk);
+      err = buf == NULL ? -1 : voided_lf_write(fd, wbuf, &wlen, buf, blk->zraw);
+      off += blk->zraw;
+      free(buf);
+    } else if(blk->dirty){
+      int r;
+      for(r = 0; r < blk->nrows && !err; r++){
+        err = voided_lf_write(fd, wbuf, &wlen, blk->rows[r].chars, blk->rows[r].size) ||
+              voided_lf_write(fd, wbuf, &wlen, "\n", 1);
+        off += blk->rows[r].size + 1;
+      }
+    } else{
+      long done = 0;
+      while(done < blk->len && !err){
+        if(wlen == VOID_LF_IO){
+          err = voided_write_all(fd, wbuf, wlen);
+          wlen = 0;
+        }
+        long want = blk->len - done < VOID_LF_IO - wlen ? blk->len - done : VOID_LF_IO - wlen;
+        ssize_t n = pread(lf->fd, wbuf + wlen, want, blk->off + done);
+        if(n <= 0){
+          if(n == 0) errno = EIO;
+          err = -1;
+        } else{
+          wlen += n;
+          done += n;
+        }
+      }
+      off += blk->len;
+    }
+  }
+  if(!err) err = voided_write_all(fd, wbuf, wlen);
+  if(!err) err = fsync(fd);
+  close(fd);
+  free(wbuf);
+
+  int newfd = -1;
+  if(!err) err = rename(tmp, path);
+  if(err){
+    int saved = errno;
+    unlink(tmp);
+    errno = saved;
+  } else newfd = open(path, O_RDONLY | O_CLOEXEC);
+  free(tmp);
+  free(path);
+  if(err || newfd == -1){
+    free(newoff);
+    return -1;
+  }
+
+  // the blocks now describe the new file
+  close(lf->fd);
+  lf->fd = newfd;
+  for(b = 0; b < lf->nblocks; b++){
+    lf->blocks[b].off = newoff[b];
+    lf->blocks[b].len = (b + 1 < lf->nblocks ? newoff[b + 1] : off) - newoff[b];
+    lf->blocks[b].dirty = 0;
+    lf->blocks[b].spillcap = 0;
+    // evicted blocks are read from the file again
+    voided_lf_unpacked(&lf->blocks[b]);
+  }
+  free(newoff);
+  // nothing in the spill file is needed any more
+  if(lf->spill != -1 && ftruncate(lf->spill, 0) == 0) lf->spillend = 0;
+  voided_lf_evict();
+  return off;
+}
+
+// ':stats': how much of the buffer is held, and how, in the message bar
+void voided_stats(){
+  struct lfile *lf = &E.buf->lf;
+  if(!lf->on){
+    long bytes = 0;
+    int r;
+    for(r = 0; r < E.buf->numrows; r++)
+      bytes += E.buf->row[r].size + E.buf->row[r].rsize;
+    voided_set_status_msg("%d lines, %ld KB of text and render", 1, E.buf->numrows, bytes >> 10);
+    return;
+  }
+  int packed = 0;
+  int b;
+  for(b = 0; b < lf->nblocks; b++)
+    if(lf->blocks[b].z) packed++;
+  voided_set_status_msg("%d lines, %d/%d hot (%ld/%ldM), %d packed %ldK->%ldK, %ldK spilled", 1,
+                        E.buf->numrows, lf->nloaded, lf->nblocks, lf->resident >> 20,
+                        lf->budget >> 20, packed, lf->zraw >> 10, lf->zlen >> 10,
+                        lf->spillend >> 10);
+}
+
+/*** file i/o ***/
+
+// converts all rows into one big heap-allocated buffer.
+// ***DO NOT FORGET TO FREE THE RETURNED BUF!***
+char *voided_rows_to_string(int *buflen){
+  int totlen = 0;
+  int j;
+
+  for(j = 0; j < E.buf->numrows; j++)
+    totlen += E.buf->row[j].size + 1;
+  *buflen = totlen;
+
+  char *buf = malloc(totlen);
+  char *p = buf;
+  
+  for(j = 0; j < E.buf->numrows; j++){
+    memcpy(p, E.buf->row[j].chars, E.buf->row[j].size);
+    p += E.buf->row[j].size;
+    *p = '\n';
+    p++;
+  }
+
+  return buf;
+}
+
+// opens file and appends each line to a row. the file is mapped rather
+// than read where it can be, and split into rows by voided_index_lines()
+// force and compress are -L and -z. returns -1 (with errno set) if the
+// file can't be opened or isn't a regular file
+int voided_open(const char *filename, const char force, const char compress){
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if(fd == -1) return -1;
+  struct stat st;
+  int err = fstat(fd, &st) == -1 ? errno :
+            S_ISDIR(st.st_mode) ? EISDIR :
+            !S_ISREG(st.st_mode) ? EINVAL : 0;
+  if(err){
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  free(E.buf->filename);
+  E.buf->filename = strdup(filename);
+
+  long size = st.st_size;
+  char partial = 0;
+  // a file that says it's empty may have something to read after all, so
+  // it's never paged
+  if(size > 0 && (force || compress || size > lf_budget)){
+    E.buf->lf.budget = lf_budget;
+    // too big to hold: fd stays open to read blocks from
+    if(voided_lf_open(fd, size, compress) == -1){
+      close(fd);
+      errno = EFBIG;
+      return -1;
+    }
+    voided_words_start(&E.buf->words, fcntl(fd, F_DUPFD_CLOEXEC, 0));
+    char c;
+    partial = size > 0 && pread(fd, &c, 1, size - 1) == 1 && c != '\n';
+    E.buf->dirty = 0;
+    voided_watch_mark(size, partial);
+    voided_journal_open(1);
+    return 0;
+  }
+  char *buf = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  char mapped = buf != MAP_FAILED;
+  if(mapped){
+    madvise(buf, size, MADV_SEQUENTIAL);
+  } else if((buf = voided_read_fd(fd, &size)) == NULL){
+    err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  if(size > 0){
+    erow *rows;
+    int n = voided_index_lines(buf, size, &rows);
+    voided_insert_rows(E.buf->numrows, rows, n);
+    free(rows);
+    partial = buf[size - 1] != '\n';
+  }
+  if(mapped) munmap(buf, size);
+  else free(buf);
+  // the index is built from the file on the side, so fd stays open for it
+  voided_words_start(&E.buf->words, fd);
+  E.buf->dirty = 0;
+  voided_watch_mark(size, partial);
+
+  voided_journal_open(1);
+  return 0;
+}
+
+// the 'save as' prompt answered
+void voided_save_as(char *filename){
+  if(filename == NULL){
+    voided_set_status_msg("save aborted", 1);
+    return;
+  }
+  E.buf->filename = voided_view_path(filename);
+  free(filename);
+  voided_save();
+}
+
+char voided_save(){
+  if(E.buf->filename == NULL){
+    voided_prompt("save as: %s", voided_save_as);
+    return 1;
+  }
+  if(E.buf->lf.on){
+    long len = voided_lf_save();
+    if(len == -1){
+      voided_set_status_msg("can't save! I/O error: %s", 1, strerror(errno));
+      return 0;
+    }
+    voided_set_status_msg("wrote %ld bytes to '%s'", 1, len, E.buf->filename);
+    E.buf->dirty = 0;
+    // the file is now what the buffer holds, so it can be counted again
+    if(E.buf->words.stale)
+      voided_words_start(&E.buf->words, fcntl(E.buf->lf.fd, F_DUPFD_CLOEXEC, 0));
+    voided_watch_mark(len, 0);
+    voided_journal_reset();
+    return 0;
+  }
+  int len;
+  char *buf = voided_rows_to_string(&len);
+
+  int fd = open(E.buf->filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if(fd != -1){
+    if(ftruncate(fd, len) != -1){
+      if(write(fd, buf, len) == len){
+	close(fd);
+	free(buf);
+	voided_set_status_msg("wrote %d bytes to '%s'", 1, len, E.buf->filename);
+	E.buf->dirty = 0;
+	voided_watch_mark(len, 0);
+	if(E.buf->jrn.fd == -1) voided_journal_open(0);
+	else voided_journal_reset();
+	return 0;
+      }
+    }
+    close(fd);
+  }
+  free(buf);
+  voided_set_status_msg("can't save! I/O error: %s", 1, strerror(errno));
+  return 0;
+}
+
+/*** buffers ***/
+
+// every file named on the command line or with ':e' gets a buffer. only
+// the ones that have been shown are read in; the rest are just a name
+
+// allocates a new buffer for filename (NULL for a scratch one) and adds
+// it to the list of open ones
+struct ebuf *voided_buf_new(const char *filename){
+  struct ebuf *b = calloc(1, sizeof(struct ebuf));
+  b->filename = filename ? strdup(filename) : NULL;
+  b->loaded = filename == NULL;
+  b->jrn.fd = -1;
+  b->watch.fd = -1;
+  b->lf.fd = -1;
+  b->lf.spill = -1;
+  if(filename == NULL) voided_words_start(&b->words, -1);
+  bufs = realloc(bufs, sizeof(struct ebuf *) * (nbufs + 1));
+  bufs[nbufs++] = b;
+  return b;
+}
+
+// whether a and b name the same file: the same inode, or for files that
+// aren't there yet the same name in the same directory
+char voided_same_file(const char *a, const char *b){
+  if(strcmp(a, b) == 0) return 1;
+  struct stat sa, sb;
+  int ea = stat(a, &sa), eb = stat(b, &sb);
+  if(ea == 0 && eb == 0) return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+  if(ea == 0 || eb == 0) return 0;
+
+  const char *ba = strrchr(a, '/'), *bb = strrchr(b, '/');
+  ba = ba ? ba + 1 : a;
+  bb = bb ? bb + 1 : b;
+  if(strcmp(ba, bb) != 0) return 0;
+  char *da = strndup(a, ba - a), *db = strndup(b, bb - b);
+  char same = stat(*da ? da : ".", &sa) == 0 && stat(*db ? db : ".", &sb) == 0 &&
+              sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+  free(da);
+  free(db);
+  return same;
+}
+
+// the buffer for filename, whatever name it was opened under. two buffers
+// on one file would share, and garble, its journal
+struct ebuf *voided_buf_find(const char *filename){
+  int i;
+  for(i = 0; i < nbufs; i++){
+    if(bufs[i]->filename && voided_same_file(bufs[i]->filename, filename)) return bufs[i];
+  }
+  return NULL;
+}
+
+// a file name typed into E, as the editor should open it. a client of the
+// daemon means its names from its own directory rather than the daemon's;
+// they're resolved to full paths. the caller frees the result
+char *voided_view_path(const char *name){
+  if(E.cwd == NULL) return strdup(name);
+  char *path = malloc(strlen(E.cwd) + strlen(name) + 2);
+  if(name[0] == '/') strcpy(path, name);
+  else sprintf(path, "%s/%s", E.cwd, name);
+  char *real = realpath(path, NULL);
+  if(real == NULL) return path;
+  free(path);
+  return real;
+}
+
+// keeps E's cursor inside its buffer, which other views may have shrunk
+void voided_view_clamp(){
+  if(E.cy > E.buf->numrows) E.cy = E.buf->numrows;
+  if(E.vy > E.buf->numrows) E.vy = E.buf->numrows;
+  int size = E.cy < E.buf->numrows ? voided_row(E.cy)->size : 0;
+  if(E.cx > size) E.cx = size;
+}
+
+// bytes held by b's rows, render strings and word index included
+long voided_buf_mem(const struct ebuf *b){
+  if(!b->loaded) return 0;
+  if(b->lf.on) return b->lf.resident + b->lf.zlen + voided_words_mem(&b->words);
+  long n = (long)b->numrows * sizeof(erow) + voided_words_mem(&b->words);
+  int r;
+  for(r = 0; r < b->numrows; r++)
+    n += b->row[r].size + b->row[r].rsize;
+  return n;
+}
+
+// drops what b can rebuild for itself: render strings, which are made
+// again when the rows are drawn, or in large file mode every loaded block
+void voided_buf_drop_cache(struct ebuf *b){
+  if(b->lf.on){
+    struct ebuf *cur = E.buf;
+    E.buf = b;
+    while(b->lf.nloaded > 0 && voided_lf_unload(0) == 0)
+      ;
+    E.buf = cur;
+    return;
+  }
+  int r;
+  for(r = 0; r < b->numrows; r++){
+    free(b->row[r].render);
+    b->row[r].render = NULL;
+    b->row[r].rsize = 0;
+  }
+}
+
+// frees everything a clean buffer holds. its file is read in again when
+// it is next shown
+void voided_buf_unload(struct ebuf *b){
+  struct ebuf *cur = E.buf;
+  E.buf = b;
+  voided_journal_quit();
+  if(b->lf.on){
+    // the buffer is clean, so nothing has to be kept from the blocks
+    b->lf.compress = 0;
+    while(b->lf.nloaded > 0 && voided_lf_unload(0) == 0)
+      ;
+    int i;
+    for(i = 0; i < b->lf.nblocks; i++)
+      free(b->lf.blocks[i].z);
+    free(b->lf.blocks);
+    free(b->lf.loaded);
+    close(b->lf.fd);
+    if(b->lf.spill != -1) close(b->lf.spill);
+    memset(&b->lf, 0, sizeof(b->lf));
+    b->lf.fd = -1;
+    b->lf.spill = -1;
+  } else{
+    int r;
+    for(r = 0; r < b->numrows; r++)
+      voided_free_row(&b->row[r]);
+    free(b->row);
+    b->row = NULL;
+  }
+  voided_words_free(&b->words);
+  b->numrows = 0;
+  b->loaded = 0;
+  E.buf = cur;
+}
+
+// keeps what all buffers hold together within the budget. buffers no view
+// is showing give up their caches first, least recently shown first, and
+// only if that isn't enough are clean ones unloaded altogether
+void voided_buf_trim(){
+  long total = 0;
+  int *idle = malloc(sizeof(int) * nbufs);
+  int nidle = 0;
+  int i, j;
+  for(i = 0; i < nbufs; i++){
+    if(bufs[i]->views > 0) bufs[i]->mem = voided_buf_mem(bufs[i]);
+    total += bufs[i]->mem;
+    if(bufs[i]->views > 0 || !bufs[i]->loaded) continue;
+    // insertion sort: oldest first
+    for(j = nidle; j > 0 && bufs[idle[j - 1]]->used > bufs[i]->used; j--)
+      idle[j] = idle[j - 1];
+    idle[j] = i;
+    nidle++;
+  }
+
+  int pass;
+  for(pass = 0; pass < 2 && total > lf_budget; pass++){
+    for(i = 0; i < nidle && total > lf_budget; i++){
+      struct ebuf *b = bufs[idle[i]];
+      if(!b->loaded) continue;
+      if(pass == 0){
+        voided_buf_drop_cache(b);
+      } else{
+        // edits only live in memory, and watched files are to be followed
+        if(b->dirty || b->filename == NULL || b->watch.fd != -1) continue;
+        voided_buf_unload(b);
+      }
+      total -= b->mem;
+      b->mem = voided_buf_mem(b);
+      total += b->mem;
+    }
+  }
+  free(idle);
+}
+
+// shows buffer b in E, reading its file in if that hasn't happened yet.
+// the cursor goes back to where it was when b was last left
+void voided_buf_show(struct ebuf *b){
+  struct ebuf *old = E.buf;
+  if(old){
+    old->cx = E.cx;
+    old->cy = E.cy;
+    old->rowoff = E.rowoff;
+    old->coloff = E.coloff;
+    old->views--;
+    old->mem = voided_buf_mem(old);
+  }
+  E.buf = b;
+  b->views++;
+  b->used = ++bufclock;
+  E.cx = b->cx;
+  E.cy = b->cy;
+  E.rowoff = b->rowoff;
+  E.coloff = b->coloff;
+  if(E.mode == VISUAL) E.mode = NORMAL;
+
+  if(!b->loaded){
+    char *name = strdup(b->filename);
+    if(voided_open(name, E.lf_force, E.lf_compress) == 0){
+      b->loaded = 1;
+    } else if(errno == ENOENT){
+      b->loaded = 1;
+      voided_words_start(&b->words, -1);
+      voided_set_status_msg("'%s' [new file]", 1, name);
+    } else{
+      voided_set_status_msg("can't open '%s': %s", 1, name, strerror(errno));
+    }
+    free(name);
+  }
+  voided_view_clamp();
+  voided_buf_trim();
+}
+
+// ':e file': shows the buffer for file, making one if there is none
+void voided_buf_edit(const char *filename){
+  if(*filename == '\0'){
+    voided_set_status_msg("no file name", 1);
+    return;
+  }
+  char *path = voided_view_path(filename);
+  struct ebuf *b = voided_buf_find(path);
+  if(b == NULL) b = voided_buf_new(path);
+  free(path);
+  if(b != E.buf) voided_buf_show(b);
+}
+
+// ':bn' and ':bp': shows the next or previous buffer in the list
+void voided_buf_cycle(const int dir){
+  if(nbufs < 2) return;
+  int i;
+  for(i = 0; i < nbufs && bufs[i] != E.buf; i++);
+  voided_buf_show(bufs[(i + dir + nbufs) % nbufs]);
+}
+
+/*** find ***/
+
+// the '/' prompt answered: moves to the first match
+void voided_find_done(char *query){
+  if(query == NULL) return;
+
+  int i;
+  for(i = 0; i < E.buf->numrows; i++){
+    erow *row = voided_row(i);
+    char *render = voided_row_render(row);
+    char *match = strstr(render, query);
+    if(match){
+      E.cy = i;
+      E.cx = voided_row_rx_to_cx(row, match - render);
+      E.rowoff = E.buf->numrows;
+      break;
+    }
+  }
+  free(query);
+}
+
+void voided_find(){
+  voided_prompt("/%s", voided_find_done);
+}
+
+/*** completion ***/
+
+int voided_is_word(const char c){
+  return isalnum((unsigned char)c) || c == '_' || (unsigned char)c >= 0x80;
+}
+
+int voided_word_cmp(const void *a, const void *b){
+  return strcmp((*(struct word **)a)->s, (*(struct word **)b)->s);
+}
+
+// merges the recent words into the sorted table
+void voided_words_merge(struct words *w){
+  qsort(w->recent, w->nrecent, sizeof(struct word *), voided_word_cmp);
+  struct word **out = malloc(sizeof(struct word *) * (w->nsorted + w->nrecent + 1));
+  long i = 0, j = 0, k = 0;
+  while(i < w->nsorted || j < w->nrecent){
+    if(j == w->nrecent || (i < w->nsorted && strcmp(w->sorted[i]->s, w->recent[j]->s) < 0))
+      out[k++] = w->sorted[i++];
+    else
+      out[k++] = w->recent[j++];
+  }
+  free(w->sorted);
+  w->sorted = out;
+  w->nsorted = k;
+  w->nrecent = 0;
+}
+
+// doubles the hash table
+void voided_words_grow(struct words *w){
+  long cap = w->tabcap ? w->tabcap * 2 : 4096;
+  struct word **tab = calloc(cap, sizeof(struct word *));
+  long i;
+  for(i = 0; i < w->tabcap; i++){
+    if(w->tab[i] == NULL) continue;
+    long j = w->tab[i]->hash & (cap - 1);
+    while(tab[j]) j = (j + 1) & (cap - 1);
+    tab[j] = w->tab[i];
+  }
+  free(w->tab);
+  __atomic_add_fetch(&w->bytes, (cap - w->tabcap) * (long)sizeof(struct word *), __ATOMIC_RELAXED);
+  w->tab = tab;
+  w->tabcap = cap;
+}
+
+// drops the words no longer in the buffer, once enough of them have piled
+// up, so they neither take up memory nor crowd out live ones. the lock must
+// be held
+void voided_words_sweep(struct words *w){
+  if(w->nrecent) voided_words_merge(w);
+  long i, k = 0;
+  for(i = 0; i < w->nsorted; i++){
+    struct word *wd = w->sorted[i];
+    if(wd->count > 0){
+      w->sorted[k++] = wd;
+      continue;
+    }
+    __atomic_sub_fetch(&w->bytes, (long)(sizeof(struct word) + wd->len + 1 + sizeof(struct word *)),
+                       __ATOMIC_RELAXED);
+    free(wd);
+  }
+  w->nsorted = k;
+  // what's left goes back in the table
+  memset(w->tab, 0, sizeof(struct word *) * w->tabcap);
+  for(i = 0; i < k; i++){
+    long j = w->sorted[i]->hash & (w->tabcap - 1);
+    while(w->tab[j]) j = (j + 1) & (w->tabcap - 1);
+    w->tab[j] = w->sorted[i];
+  }
+  w->ntab = k;
+  w->ndead = 0;
+}
+
+struct wtop *voided_wtop_new(struct words *w){
+  __atomic_add_fetch(&w->bytes, (long)sizeof(struct wtop), __ATOMIC_RELAXED);
+  return calloc(1, sizeof(struct wtop));
+}
+
+// the ranking of the words starting with the first depth (1 or 2) bytes of
+// s. if there is none yet, it's made when make is set
+struct wtop *voided_wtop_node(struct words *w, const char *s, const int depth, const char make){
+  struct wtop **t = &w->top[(unsigned char)s[0]];
+  if(*t == NULL){
+    if(!make) return NULL;
+    *t = voided_wtop_new(w);
+  }
+  if(depth == 1) return *t;
+  if((*t)->next == NULL){
+    if(!make) return NULL;
+    (*t)->next = calloc(256, sizeof(struct wtop *));
+    __atomic_add_fetch(&w->bytes, 256 * (long)sizeof(struct wtop *), __ATOMIC_RELAXED);
+  }
+  t = &(*t)->next[(unsigned char)s[1]];
+  if(*t == NULL){
+    if(!make) return NULL;
+    *t = voided_wtop_new(w);
+  }
+  return *t;
+}
+
+// moves wd to where its count now puts it in t, in which wd's flag is bit.
+// a word that's left out (or pushed out) raises t's floor
+void voided_wtop_update(struct wtop *t, struct word *wd, const unsigned char bit){
+  int i;
+  if(wd->top & bit){
+    for(i = 0; t->w[i] != wd; i++);
+    if(wd->count <= 0){
+      t->n--;
+      memmove(&t->w[i], &t->w[i + 1], sizeof(struct word *) * (t->n - i));
+      wd->top &= ~bit;
+      return;
+    }
+  } else{
+    if(wd->count <= 0) return;
+    if(t->n == VOID_WORDS_TOP){
+      struct word *last = t->w[t->n - 1];
+      if(last->count >= wd->count){
+        if(wd->count > t->floor) t->floor = wd->count;
+        return;
+      }
+      if(last->count > t->floor) t->floor = last->count;
+      last->top &= ~bit;
+      t->n--;
+    }
+    i = t->n++;
+    t->w[i] = wd;
+    wd->top |= bit;
+  }
+  while(i > 0 && t->w[i - 1]->count < wd->count){
+    t->w[i] = t->w[i - 1];
+    t->w[--i] = wd;
+  }
+  while(i < t->n - 1 && t->w[i + 1]->count > wd->count){
+    t->w[i] = t->w[i + 1];
+    t->w[++i] = wd;
+  }
+}
+
+// brings wd's rankings up to date after its count changed. the lock must
+// be held
+void voided_words_rank(struct words *w, struct word *wd){
+  int depth;
+  for(depth = 1; depth <= 2; depth++){
+    struct wtop *t = voided_wtop_node(w, wd->s, depth, wd->count > 0);
+    if(t) voided_wtop_update(t, wd, depth);
+  }
+}
+
+// ranks every word, once the scan is done. the lock must be held
+void voided_words_rank_all(struct words *w){
+  w->top = calloc(256, sizeof(struct wtop *));
+  __atomic_add_fetch(&w->bytes, 256 * (long)sizeof(struct wtop *), __ATOMIC_RELAXED);
+  long i;
+  for(i = 0; i < w->nsorted; i++)
+    voided_words_rank(w, w->sorted[i]);
+  for(i = 0; i < w->nrecent; i++)
+    voided_words_rank(w, w->recent[i]);
+}
+
+// adds delta to the count of word s, interning it if it's new. the lock
+// must be held
+void voided_words_add(struct words *w, const char *s, const int len, const int delta){
+  if(len < VOID_WORD_MIN || len > VOID_WORD_MAX) return;
+  if(w->ntab * 2 >= w->tabcap) voided_words_grow(w);
+
+  // FNV-1a
+  unsigned int h = 2166136261u;
+  int i;
+  for(i = 0; i < len; i++)
+    h = (h ^ (unsigned char)s[i]) * 16777619u;
+
+  long j = h & (w->tabcap - 1);
+  struct word *wd;
+  while((wd = w->tab[j]) != NULL){
+    if(wd->hash == h && wd->len == len && memcmp(wd->s, s, len) == 0){
+      int was = wd->count;
+      wd->count += delta;
+      if(w->top) voided_words_rank(w, wd);
+      if(was > 0 && wd->count <= 0 && w->sorted && ++w->ndead > VOID_WORDS_RECENT &&
+         w->ndead * 4 > w->ntab)
+        voided_words_sweep(w);
+      return;
+    }
+    j = (j + 1) & (w->tabcap - 1);
+  }
+  // once the scan is done, a word that isn't there was left out when the
+  // index filled up
+  if(w->ready && delta <= 0) return;
+  long size = sizeof(struct word) + len + 1 + sizeof(struct word *);
+  if(w->full || (w->limit && w->bytes + size > w->limit)){
+    w->full = 1;
+    return;
+  }
+  __atomic_add_fetch(&w->bytes, size, __ATOMIC_RELAXED);
+  wd = malloc(sizeof(struct word) + len + 1);
+  wd->count = delta;
+  wd->len = len;
+  wd->hash = h;
+  wd->top = 0;
+  memcpy(wd->s, s, len);
+  wd->s[len] = '\0';
+  w->tab[j] = wd;
+  w->ntab++;
+  if(w->top) voided_words_rank(w, wd);
+
+  // words met before the scan is done are sorted along with all the others
+  if(!w->ready) return;
+  if(w->nrecent % VOID_WORDS_RECENT == 0)
+    w->recent = realloc(w->recent, sizeof(struct word *) * (w->nrecent + VOID_WORDS_RECENT));
+  w->recent[w->nrecent++] = wd;
+  if(w->nrecent >= VOID_WORDS_RECENT && w->sorted) voided_words_merge(w);
+}
+
+// adds delta to the count of every word in len bytes of s
+void voided_words_text(struct words *w, const char *s, const long len, const int delta){
+  long i = 0;
+  int batch = 0;
+  pthread_mutex_lock(&w->lock);
+  while(i < len){
+    while(i < len && !voided_is_word(s[i])) i++;
+    long start = i;
+    while(i < len && voided_is_word(s[i])) i++;
+    if(i > start) voided_words_add(w, &s[start], i - start, delta);
+    // let edits in now and then during a scan
+    if(++batch == 4096){
+      pthread_mutex_unlock(&w->lock);
+      pthread_mutex_lock(&w->lock);
+      batch = 0;
+    }
+  }
+  pthread_mutex_unlock(&w->lock);
+}
+
+// counts (delta 1) or uncounts (delta -1) the words of row that touch
+// columns [from, to], before or after row is changed there
+void voided_words_span(const erow *row, int from, int to, const int delta){
+  struct words *w = &E.buf->words;
+  if(!w->on) return;
+  while(from > 0 && voided_is_word(row->chars[from - 1])) from--;
+  while(to < row->size && voided_is_word(row->chars[to])) to++;
+  voided_words_text(w, &row->chars[from], to - from, delta);
+}
+
+// counts (delta 1) or uncounts (delta -1) the words of s that touch any of
+// the n spans of len bytes at at[0] < at[1] < ... spans whose words run
+// together are counted once
+void voided_words_spans(struct words *w, const char *s, const long size, const long *at,
+                        const int n, const long len, const int delta){
+  long from = 0, to = -1;
+  int i;
+  for(i = 0; i < n; i++){
+    long a = at[i], b = at[i] + len;
+    while(a > 0 && voided_is_word(s[a - 1])) a--;
+    while(b < size && voided_is_word(s[b])) b++;
+    if(to >= 0 && a <= to){
+      to = b;
+      continue;
+    }
+    if(to >= 0) voided_words_text(w, &s[from], to - from, delta);
+    from = a;
+    to = b;
+  }
+  if(to >= 0) voided_words_text(w, &s[from], to - from, delta);
+}
+
+// a table that only collects changes to word counts, to be added to a
+// buffer's index later by voided_words_apply()
+void voided_words_init(struct words *w){
+  memset(w, 0, sizeof(*w));
+  pthread_mutex_init(&w->lock, NULL);
+  voided_words_grow(w);
+  w->on = 1;
+}
+
+// adds the changes collected in d to w, and frees d's table
+void voided_words_apply(struct words *w, struct words *d){
+  if(w->on){
+    pthread_mutex_lock(&w->lock);
+    long i;
+    for(i = 0; i < d->tabcap; i++){
+      struct word *wd = d->tab[i];
+      if(wd && wd->count != 0) voided_words_add(w, wd->s, wd->len, wd->count);
+    }
+    pthread_mutex_unlock(&w->lock);
+  }
+  voided_words_free(d);
+}
+
+// bytes held by w's index
+long voided_words_mem(const struct words *w){
+  return __atomic_load_n(&w->bytes, __ATOMIC_RELAXED);
+}
+
+// counts the words of the file at w->fd, which the thread closes when done
+void *voided_words_scan(void *p){
+  struct words *w = p;
+  char *buf = malloc(VOID_LF_IO);
+  long off = 0, keep = 0;
+  ssize_t n;
+  while(!__atomic_load_n(&w->stop, __ATOMIC_RELAXED) &&
+        (n = pread(w->fd, buf + keep, VOID_LF_IO - keep, off)) > 0){
+    off += n;
+    long len = keep + n;
+    // a word cut off by the end of the read is finished by the next one
+    long end = len;
+    while(end > 0 && voided_is_word(buf[end - 1])) end--;
+    if(end == 0) end = len;
+    voided_words_text(w, buf, end, 1);
+    keep = len - end;
+    memmove(buf, buf + end, keep);
+  }
+  voided_words_text(w, buf, keep, 1);
+  free(buf);
+  close(w->fd);
+
+  // everything met so far gets sorted. words met from here on go to recent
+  pthread_mutex_lock(&w->lock);
+  struct word **all = malloc(sizeof(struct word *) * (w->ntab + 1));
+  long nall = 0, i;
+  for(i = 0; i < w->tabcap; i++)
+    if(w->tab[i]) all[nall++] = w->tab[i];
+  w->ready = 1;
+  pthread_mutex_unlock(&w->lock);
+
+  qsort(all, nall, sizeof(struct word *), voided_word_cmp);
+
+  pthread_mutex_lock(&w->lock);
+  w->sorted = all;
+  w->nsorted = nall;
+  if(w->nrecent >= VOID_WORDS_RECENT) voided_words_merge(w);
+  voided_words_rank_all(w);
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+// starts indexing a freshly loaded buffer, whose words are those of the file
+// at fd (or none, if fd is -1). w takes fd over
+void voided_words_start(struct words *w, const int fd){
+  voided_words_free(w);
+  pthread_mutex_init(&w->lock, NULL);
+  voided_words_grow(w);
+  w->on = 1;
+  w->fd = fd;
+  w->limit = lf_budget / VOID_WORDS_SHARE;
+  if(fd == -1){
+    w->ready = 1;
+    w->sorted = malloc(sizeof(struct word *));
+    voided_words_rank_all(w);
+    return;
+  }
+  if(pthread_create(&w->tid, NULL, voided_words_scan, w) == 0) w->scanning = 1;
+  else voided_words_scan(w);
+}
+
+void voided_words_free(struct words *w){
+  if(!w->on) return;
+  if(w->scanning){
+    __atomic_store_n(&w->stop, 1, __ATOMIC_RELAXED);
+    pthread_join(w->tid, NULL);
+  }
+  long i;
+  for(i = 0; i < w->tabcap; i++)
+    free(w->tab[i]);
+  free(w->tab);
+  for(i = 0; w->top && i < 256; i++){
+    if(w->top[i] == NULL) continue;
+    int j;
+    for(j = 0; w->top[i]->next && j < 256; j++)
+      free(w->top[i]->next[j]);
+    free(w->top[i]->next);
+    free(w->top[i]);
+  }
+  free(w->top);
+  free(w->sorted);
+  free(w->recent);
+  pthread_mutex_destroy(&w->lock);
+  memset(w, 0, sizeof(*w));
+}
+
+// keeps the max most frequent words among cands with w inserted
+int voided_words_pick(struct word **cands, int n, const int max, struct word *w){
+  int i;
+  if(n < max) i = n++;
+  else if(cands[max - 1]->count >= w->count) return n;
+  else i = max - 1;
+  while(i > 0 && cands[i - 1]->count < w->count){
+    cands[i] = cands[i - 1];
+    i--;
+  }
+  cands[i] = w;
+  return n;
+}
+
+// the first sorted word not below pre
+long voided_words_lower(const struct words *w, const char *pre){
+  long lo = 0, hi = w->nsorted;
+  while(lo < hi){
+    long mid = (lo + hi) / 2;
+    if(strcmp(w->sorted[mid]->s, pre) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// ranks the words starting with pre in t from scratch, once too many of
+// them have dropped below its floor. the lock must be held
+void voided_wtop_rebuild(struct words *w, struct wtop *t, const char *pre, const int plen){
+  int i;
+  for(i = 0; i < t->n; i++)
+    t->w[i]->top &= ~plen;
+  t->n = 0;
+  t->floor = 0;
+  long j;
+  for(j = voided_words_lower(w, pre); j < w->nsorted; j++){
+    if(strncmp(w->sorted[j]->s, pre, plen) != 0) break;
+    voided_wtop_update(t, w->sorted[j], plen);
+  }
+  for(j = 0; j < w->nrecent; j++){
+    if(strncmp(w->recent[j]->s, pre, plen) == 0) voided_wtop_update(t, w->recent[j], plen);
+  }
+}
+
+// takes up to max words longer than plen from t, for as long as the order
+// is sure: a word below the floor may have been overtaken by one left out
+int voided_wtop_pick(const struct wtop *t, const int plen, struct word **cands, const int max){
+  int i, n = 0;
+  for(i = 0; i < t->n && n < max; i++){
+    if(t->w[i]->count < t->floor) break;
+    if(t->w[i]->len > plen) cands[n++] = t->w[i];
+  }
+  return n;
+}
+
+// finds up to max words starting with prefix (but longer), most frequent
+// first, and copies them to out. returns how many, or -1 while the buffer
+// is still being scanned
+int voided_words_complete(const char *prefix, const int plen, char **out, const int max){
+  struct words *w = &E.buf->words;
+  if(!w->on) return -1;
+  struct word *cands[VOID_COMPLETE_MAX];
+  int n = 0;
+  char *pre = strndup(prefix, plen);
+
+  pthread_mutex_lock(&w->lock);
+  if(w->sorted == NULL){
+    pthread_mutex_unlock(&w->lock);
+    free(pre);
+    return -1;
+  }
+  long i;
+  if(plen <= 2){
+    // short prefixes are shared by the most words, so they're ranked as the
+    // counts change
+    struct wtop *t = voided_wtop_node(w, pre, plen, 0);
+    if(t){
+      n = voided_wtop_pick(t, plen, cands, max);
+      if(n < max && t->floor > 0){
+        voided_wtop_rebuild(w, t, pre, plen);
+        n = voided_wtop_pick(t, plen, cands, max);
+      }
+    }
+  } else{
+    // every word with a longer prefix is looked at. there are few of them
+    // unless most words of the buffer share it
+    for(i = voided_words_lower(w, pre); i < w->nsorted; i++){
+      struct word *wd = w->sorted[i];
+      if(strncmp(wd->s, pre, plen) != 0) break;
+      if(wd->count > 0 && wd->len > plen) n = voided_words_pick(cands, n, max, wd);
+    }
+    for(i = 0; i < w->nrecent; i++){
+      struct word *wd = w->recent[i];
+      if(wd->count > 0 && wd->len > plen && strncmp(wd->s, pre, plen) == 0)
+        n = voided_words_pick(cands, n, max, wd);
+    }
+  }
+  for(i = 0; i < n; i++)
+    out[i] = strdup(cands[i]->s);
+  pthread_mutex_unlock(&w->lock);
+  free(pre);
+  return n;
+}
+
+// ends the completion in progress, keeping whatever word is in place
+void voided_complete_end(){
+  int i;
+  for(i = 0; i < E.comp.n; i++)
+    free(E.comp.cands[i]);
+  free(E.comp.cands);
+  free(E.comp.prefix);
+  E.comp.cands = NULL;
+  E.comp.prefix = NULL;
+  E.comp.n = 0;
+}
+
+// Ctrl-N (dir 1) and Ctrl-P (dir -1) in insert mode: completes the word
+// before the cursor, then cycles through the other candidates and back to
+// what was typed
+void voided_complete(const int dir){
+  // the cursor has to still be in the word being completed
+  if(E.comp.cands && (E.cy != E.comp.row || E.cy >= E.buf->numrows ||
+                      E.cx < E.comp.start || E.cx > voided_row(E.cy)->size))
+    voided_complete_end();
+  if(E.comp.cands == NULL){
+    if(E.cy >= E.buf->numrows) return;
+    erow *row = voided_row(E.cy);
+    int start = E.cx;
+    while(start > 0 && voided_is_word(row->chars[start - 1])) start--;
+    if(start == E.cx){
+      voided_set_status_msg("nothing to complete", 1);
+      return;
+    }
+    char **cands = malloc(sizeof(char *) * VOID_COMPLETE_MAX);
+    int n = voided_words_complete(&row->chars[start], E.cx - start, cands, VOID_COMPLETE_MAX);
+    if(n <= 0){
+      free(cands);
+      if(n == -1) voided_set_status_msg("still indexing words, try again in a moment", 1);
+      else voided_set_status_msg("no completions for '%.*s'%s", 1, E.cx - start, &row->chars[start],
+                                 E.buf->words.full ? " (word index is full)" : "");
+      return;
+    }
+    E.comp.cands = cands;
+    E.comp.n = n;
+    E.comp.idx = n;
+    E.comp.prefix = strndup(&row->chars[start], E.cx - start);
+    E.comp.row = E.cy;
+    E.comp.start = start;
+  }
+
+  E.comp.idx = (E.comp.idx + dir + E.comp.n + 1) % (E.comp.n + 1);
+  const char *word = E.comp.idx == E.comp.n ? E.comp.prefix : E.comp.cands[E.comp.idx];
+  int len = strlen(word);
+  voided_row_del_string(voided_row(E.cy), E.comp.start, E.cx - E.comp.start);
+  voided_row_insert_string(voided_row(E.cy), E.comp.start, word, len);
+  E.cx = E.comp.start + len;
+  if(E.comp.idx == E.comp.n)
+    voided_set_status_msg("back at original", 1);
+  else
+    voided_set_status_msg("match %d of %d", 1, E.comp.idx + 1, E.comp.n);
+}
+
+/*** ex commands ***/
+
+// row ranges at least this long get split across worker threads
+// (set to 0 to always run range commands on a single thread)
+#define VOID_PAR_ROWS 32768
+
+// a chunk of rows handed to a worker thread
+typedef void (*row_job_fn)(const int start, const int end, void *arg, int *count);
+
+struct row_job{
+  row_job_fn fn;
+  void *arg;
+  int start, end;          // rows [start, end) handled by this job
+  int count;               // whatever the job wants to report back (matches, changes...)
+  pthread_t tid;
+};
+
+void *voided_row_job_run(void *p){
+  struct row_job *job = p;
+  job->fn(job->start, job->end, job->arg, &job->count);
+  return NULL;
+}
+
+// runs fn over rows [start, end], in parallel chunks when the range is big
+// enough. returns the sum of every chunk's count
+int voided_par_rows(const int start, const int end, row_job_fn fn, void *arg){
+  int n = end - start + 1;
+  int nthreads = 1;
+  // large file blocks are loaded on demand, which only the main thread may do
+  if(VOID_PAR_ROWS > 0 && n >= VOID_PAR_ROWS && !E.buf->lf.on)
+    nthreads = voided_ncpus();
+
+  struct row_job jobs[VOID_MAX_THREADS];
+  int chunk = n / nthreads;
+  int i;
+  for(i = 0; i < nthreads; i++){
+    jobs[i].fn = fn;
+    jobs[i].arg = arg;
+    jobs[i].start = start + i * chunk;
+    jobs[i].end = (i == nthreads - 1) ? end + 1 : jobs[i].start + chunk;
+    jobs[i].count = 0;
+  }
+  // the calling thread takes the first chunk itself
+  for(i = 1; i < nthreads; i++){
+    if(pthread_create(&jobs[i].tid, NULL, voided_row_job_run, &jobs[i]) != 0){
+      voided_row_job_run(&jobs[i]);
+      jobs[i].tid = 0;
+    }
+  }
+  voided_row_job_run(&jobs[0]);
+
+  int total = jobs[0].count;
+  for(i = 1; i < nthreads; i++){
+    if(jobs[i].tid) pthread_join(jobs[i].tid, NULL);
+    total += jobs[i].count;
+  }
+  return total;
+}
+
+struct global_job{
+  const char *pat;
+  unsigned char *mark;     // one flag per row, mark[0] is the first row of the range
+  int first;
+};
+
+void voided_global_job(const int start, const int end, void *arg, int *count){
+  struct global_job *g = arg;
+  int r;
+  for(r = start; r < end; r++){
+    if(strstr(voided_row(r)->chars, g->pat)){
+      g->mark[r - g->first] = 1;
+      (*count)++;
+    }
+  }
+}
+
+struct subst_job{
+  const char *old, *new;
+  size_t oldlen, newlen;
+  char all;                // replace every match in a row, not just the first
+  unsigned char *changed;  // if not NULL, flags the rows that were rewritten
+  int first;               // row that changed[0] stands for
+  int nrows;               // rows in the range
+  struct words *deltas[VOID_MAX_THREADS]; // word counts changed by each chunk
+  int ndeltas;
+};
+
+// rewrites a single row, building the new contents in one allocation.
+// returns the number of substitutions made
+int voided_row_subst(erow *row, struct subst_job *s, struct words *d){
+  int n = 0;
+  char *p = row->chars;
+  char *m;
+  while((m = strstr(p, s->old)) != NULL){
+    n++;
+    p = m + s->oldlen;
+    if(!s->all) break;
+  }
+  if(n == 0) return 0;
+
+  long diff = (long)s->newlen - (long)s->oldlen;
+  size_t len = row->size + (long)n * diff;
+  char *buf = voided_chars_new(NULL, len);
+  char *dst = buf;
+  // where each match starts, for the words around it to be recounted
+  long few[8];
+  long *at = n > 8 ? malloc(sizeof(long) * n) : few;
+  int i;
+  p = row->chars;
+  for(i = 0; i < n; i++){
+    m = strstr(p, s->old);
+    at[i] = m - row->chars;
+    memcpy(dst, p, m - p);
+    dst += m - p;
+    memcpy(dst, s->new, s->newlen);
+    dst += s->newlen;
+    p = m + s->oldlen;
+  }
+  memcpy(dst, p, row->chars + row->size - p);
+  // only the words touching a match change
+  voided_words_spans(d, row->chars, row->size, at, n, s->oldlen, -1);
+  for(i = 0; i < n; i++)
+    at[i] += i * diff;
+  voided_words_spans(d, buf, len, at, n, s->newlen, 1);
+  if(at != few) free(at);
+  voided_chars_unref(row->chars);
+  row->chars = buf;
+  row->size = len;
+  voided_update_row(row);
+  return n;
+}
+
+void voided_subst_job(const int start, const int end, void *arg, int *count){
+  struct subst_job *s = arg;
+  // words are counted on the side, for the main thread to add up once
+  // every chunk is done
+  struct words *d = malloc(sizeof(struct words));
+  voided_words_init(d);
+  // each chunk gets its share of the index's limit. counts past it are
+  // dropped, the same as words met once the index is full
+  if(E.buf->words.limit)
+    d->limit = (long)((double)E.buf->words.limit * (end - start) / s->nrows) + 1;
+  int r;
+  for(r = start; r < end; r++){
+    erow *row = voided_row(r);
+    if(voided_row_subst(row, s, d) > 0){
+      if(s->changed) s->changed[r - s->first] = 1;
+      // large files only ever run here on the main thread, and the block
+      // has to be marked before it can be evicted and the edit dropped
+      if(E.buf->lf.on) voided_row_modified(row);
+      (*count)++;
+    }
+  }
+  s->deltas[__atomic_fetch_add(&s->ndeltas, 1, __ATOMIC_RELAXED)] = d;
+}
+
+// rows handed to a single writev call (each takes two iovecs: the row and
+// its newline)
+#define VOID_FILTER_IOV 64
+#define VOID_FILTER_GRACE 2      // seconds an interrupted filter has to exit before SIGKILL
+
+// the command's output as it comes in. rows are built as soon as their
+// newline arrives; only a line that's still incomplete is kept as text
+struct filter_out{
+  struct index_job rows;
+  char *part;
+  size_t partlen, partcap;
+};
+
+void voided_filter_parse(struct filter_out *out, const char *buf, const size_t len){
+  const char *s = buf, *end = buf + len, *e;
+  while((e = memchr(s, '\n', end - s)) != NULL){
+    if(out->partlen > 0){
+      // finish the line begun by an earlier read
+      size_t n = e - s;
+      if(out->partlen + n > out->partcap){
+        out->partcap = out->partlen + n;
+        out->part = realloc(out->part, out->partcap);
+      }
+      memcpy(out->part + out->partlen, s, n);
+      voided_index_push(&out->rows, out->part, out->part + out->partlen + n);
+      out->partlen = 0;
+    } else{
+      voided_index_push(&out->rows, s, e);
+    }
+    s = e + 1;
+  }
+  if(s < end){
+    size_t n = end - s;
+    if(out->partlen + n > out->partcap){
+      out->partcap = (out->partlen + n) * 2;
+      out->part = realloc(out->part, out->partcap);
+    }
+    memcpy(out->part + out->partlen, s, n);
+    out->partlen += n;
+  }
+}
+
+// pipes rows [start, end] through the shell command cmd and replaces them
+// with its output. rows are written straight from the buffer while the
+// output is read back, so neither side of the pipe can fill up and stall
+// the other. returns 0 on success
+int voided_filter(const int start, const int end, const char *cmd){
+  int in[2], out[2];
+  if(pipe2(in, O_CLOEXEC) == -1) return -1;
+  if(pipe2(out, O_CLOEXEC) == -1){
+    close(in[0]);
+    close(in[1]);
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if(pid == -1){
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    return -1;
+  }
+  // its own process group, so a whole pipeline can be stopped at once
+  setpgid(pid, pid);
+  if(pid == 0){
+    setpgid(0, 0);
+    // a daemon's client expects the command to run where it is
+    if(E.cwd && chdir(E.cwd) == -1) _exit(127);
+    // stderr would land on top of the editor's screen
+    int null = open("/dev/null", O_WRONLY);
+    dup2(in[0], STDIN_FILENO);
+    dup2(out[1], STDOUT_FILENO);
+    if(null != -1){
+      dup2(null, STDERR_FILENO);
+      close(null);
+    }
+    execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+    _exit(127);
+  }
+  close(in[0]);
+  close(out[1]);
+  fcntl(in[1], F_SETFL, O_NONBLOCK);
+  // a command that stops reading early mustn't take the editor down
+  void (*sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+
+  struct filter_out res = {0};
+  char buf[65536];
+  int r = start;           // next row to write
+  size_t off = 0;          // bytes of it already written
+  int wfd = in[1], rfd = out[0];
+  int stopped = 0, keys = 1;
+  while(rfd != -1 && !stopped){
+    // once the typeahead is full, further keys wait in the terminal
+    int kfd = keys && E.nahead < VOID_TYPEAHEAD ? E.infd : -1;
+    struct pollfd pfds[3] = {{rfd, POLLIN, 0}, {wfd, POLLOUT, 0}, {kfd, POLLIN, 0}};
+    int ready = poll(pfds, 3, 1000);
+    // however long the command takes, edits already made keep reaching
+    // the journals. a daemon's other clients are not served meanwhile:
+    // their keys wait in their sockets, as they could change the rows
+    // being filtered
+    voided_journal_tick_all();
+    if(ready == -1){
+      if(errno == EINTR) continue;
+      break;
+    }
+
+    // Ctrl-C stops the filter, anything else is kept for after it
+    if(pfds[2].revents & (POLLIN | POLLHUP | POLLERR)){
+      char c;
+      ssize_t n = read(E.infd, &c, 1);
+      if(n == 1 && c == CTRL_KEY('c')) stopped = 1;
+      else if(n == 1) E.ahead[E.nahead++] = c;
+      else if(n == 0 || (errno != EAGAIN && errno != EINTR)) keys = 0;
+    }
+
+    if(wfd != -1 && (pfds[1].revents & (POLLOUT | POLLERR | POLLHUP))){
+      struct iovec iov[VOID_FILTER_IOV * 2];
+      char *held[VOID_FILTER_IOV];
+      size_t left[VOID_FILTER_IOV];   // bytes of each row, newline included, still to go
+      int n = 0, niov = 0, i;
+      while(n < VOID_FILTER_IOV && r + n <= end){
+        // large file blocks may be evicted while the batch is gathered
+        erow *row = voided_row(r + n);
+        size_t skip = n == 0 ? off : 0;
+        held[n] = voided_chars_ref(row->chars);
+        left[n] = row->size + 1 - skip;
+        if(skip < (size_t)row->size){
+          iov[niov].iov_base = row->chars + skip;
+          iov[niov++].iov_len = row->size - skip;
+        }
+        iov[niov].iov_base = "\n";
+        iov[niov++].iov_len = 1;
+        n++;
+      }
+      ssize_t w = n > 0 ? writev(wfd, iov, niov) : 0;
+      ssize_t done = w;
+      for(i = 0; done > 0 && i < n; i++){
+        if((size_t)done >= left[i]){
+          done -= left[i];
+          r++;
+          off = 0;
+        } else{
+          off += done;
+          done = 0;
+        }
+      }
+      for(i = 0; i < n; i++) voided_chars_unref(held[i]);
+      if(n == 0 || (w == -1 && errno != EAGAIN && errno != EINTR) || r > end){
+        close(wfd);
+        wfd = -1;
+      }
+    }
+
+    if(pfds[0].revents & (POLLIN | POLLHUP | POLLERR)){
+      ssize_t n = read(rfd, buf, sizeof(buf));
+      if(n > 0){
+        voided_filter_parse(&res, buf, n);
+      } else if(n == 0 || (errno != EAGAIN && errno != EINTR)){
+        close(rfd);
+        rfd = -1;
+      }
+    }
+  }
+  if(wfd != -1) close(wfd);
+  if(rfd != -1) close(rfd);
+
+  int status = 0;
+  pid_t done = 0;
+  if(stopped){
+    kill(-pid, SIGTERM);
+    // a command that ignores SIGTERM is given a moment, then killed
+    int i;
+    for(i = 0; i < VOID_FILTER_GRACE * 100; i++){
+      done = waitpid(pid, &status, WNOHANG);
+      if(done != 0 && !(done == -1 && errno == EINTR)) break;
+      done = 0;
+      struct timespec ts = {0, 10000000};
+      nanosleep(&ts, NULL);
+    }
+    kill(-pid, SIGKILL);
+  }
+  if(done == 0) while(waitpid(pid, &status, 0) == -1 && errno == EINTR);
+  signal(SIGPIPE, sigpipe);
+  if(res.partlen > 0) voided_index_push(&res.rows, res.part, res.part + res.partlen);
+  free(res.part);
+
+  int ok = !stopped && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  if(ok){
+    voided_replace_rows(start, end, res.rows.rows, res.rows.nrows);
+    voided_set_status_msg("%d lines filtered into %d", 1, end - start + 1, res.rows.nrows);
+  } else{
+    int i;
+    for(i = 0; i < res.rows.nrows; i++) voided_free_row(&res.rows.rows[i]);
+    if(stopped)
+      voided_set_status_msg("filter interrupted", 1);
+    else if(WIFEXITED(status))
+      voided_set_status_msg("'%s' exited with status %d", 1, cmd, WEXITSTATUS(status));
+    else
+      voided_set_status_msg("'%s' was killed", 1, cmd);
+  }
+  free(res.rows.rows);
+  return 0;
+}
+
+// parses one line address ('.', '$' or a line number, optionally followed
+// by +n or -n) and advances *p past it. returns 0 if there was none
+int voided_parse_addr(char **p, int *line){
+  char *s = *p;
+  int found = 1;
+
+  if(*s == '.'){
+    *line = E.cy;
+    s++;
+  } else if(*s == '$'){
+    *line = E.buf->numrows - 1;
+    s++;
+  } else if(isdigit(*s)){
+    *line = strtol(s, &s, 10) - 1;
+  } else if(*s == '+' || *s == '-'){
+    *line = E.cy;
+  } else{
+    found = 0;
+  }
+
+  while(*s == '+' || *s == '-'){
+    int sign = (*s == '-') ? -1 : 1;
+    s++;
+    *line += sign * (isdigit(*s) ? strtol(s, &s, 10) : 1);
+    found = 1;
+  }
+  *p = s;
+  return found;
+}
+
+// splits a delimited field ('/old/new/') in place. *p points just past the
+// opening delimiter and is left just past the closing one (or at the end of
+// the string). a backslash escapes the delimiter
+char *voided_ex_field(char **p, const char delim){
+  char *start = *p;
+  char *r = start, *w = start;
+  while(*r && *r != delim){
+    if(r[0] == '\\' && r[1] == delim) r++;
+    *w++ = *r++;
+  }
+  *p = *r ? r + 1 : r;
+  *w = '\0';
+  return start;
+}
+
+// handles ex-style ranged commands (:N, :d, :g/pat/d, :s/old/new/g, :!cmd).
+// returns 0 if buf isn't one of them
+int voided_process_ex(char *buf){
+  char *p = buf;
+  int start = E.cy, end = E.cy;
+  int ranged = 1;
+
+  if(*p == '%'){
+    start = 0;
+    end = E.buf->numrows - 1;
+    p++;
+  } else if(voided_parse_addr(&p, &start)){
+    end = start;
+    if(*p == ','){
+      p++;
+      if(!voided_parse_addr(&p, &end)){
+        voided_set_status_msg("invalid range", 1);
+        return 1;
+      }
+    }
+  } else{
+    ranged = 0;
+  }
+
+  if(*p == '\0'){
+    if(!ranged) return 0;
+    // a bare address moves the cursor there
+    E.cy = end < 0 ? 0 : (end >= E.buf->numrows ? E.buf->numrows : end);
+    E.cx = 0;
+    return 1;
+  }
+  if(*p != 'd' && *p != 'g' && *p != 's' && *p != '!') return 0;
+  if(!ranged && *p == 'g'){
+    start = 0;
+    end = E.buf->numrows - 1;
+  }
+
+  if(E.buf->numrows == 0) return 1;
+  if(start > end){
+    int t = start;
+    start = end;
+    end = t;
+  }
+  if(start < 0 || end >= E.buf->numrows){
+    voided_set_status_msg("invalid range", 1);
+    return 1;
+  }
+
+  char cmd = *p++;
+  int before = E.buf->numrows;
+  switch(cmd){
+    case 'd':
+      if(*p != '\0') break;
+      voided_del_rows(start, end);
+      voided_set_status_msg("%d fewer lines", 1, before - E.buf->numrows);
+      goto done;
+    case 'g':
+      {
+        char delim = *p++;
+        if(delim == '\0' || isalnum(delim)) break;
+        char *pat = voided_ex_field(&p, delim);
+        if(*pat == '\0' || strcmp(p, "d") != 0) break;
+
+        struct global_job g = {pat, calloc(end - start + 1, 1), start};
+        if(voided_par_rows(start, end, voided_global_job, &g) > 0)
+          voided_del_rows_marked(start, end, g.mark);
+        free(g.mark);
+        voided_set_status_msg("%d fewer lines", 1, before - E.buf->numrows);
+      }
+      goto done;
+    case 's':
+      {
+        char delim = *p++;
+        if(delim == '\0' || isalnum(delim)) break;
+        struct subst_job s;
+        s.old = voided_ex_field(&p, delim);
+        s.new = voided_ex_field(&p, delim);
+        if(*s.old == '\0' || (*p != '\0' && strcmp(p, "g") != 0)) break;
+        s.oldlen = strlen(s.old);
+        s.newlen = strlen(s.new);
+        s.all = (*p == 'g');
+        // workers can't write to the journal, so the rewritten rows are
+        // logged afterwards
+        s.changed = JOURNAL_ON() ? calloc(end - start + 1, 1) : NULL;
+        s.first = start;
+        s.nrows = end - start + 1;
+        s.ndeltas = 0;
+
+        int changed = voided_par_rows(start, end, voided_subst_job, &s);
+        int i;
+        for(i = 0; i < s.ndeltas; i++){
+          voided_words_apply(&E.buf->words, s.deltas[i]);
+          free(s.deltas[i]);
+        }
+        if(s.changed){
+          int r;
+          for(r = start; r <= end; r++){
+            if(s.changed[r - start])
+              voided_journal_rec(J_SET_ROW, r, 0, voided_row(r)->chars, voided_row(r)->size);
+          }
+          free(s.changed);
+        }
+        if(changed > 0){
+          E.buf->dirty++;
+          voided_set_status_msg("substituted on %d lines", 1, changed);
+        } else{
+          voided_set_status_msg("pattern not found: %s", 1, s.old);
+        }
+      }
+      goto done;
+    case '!':
+      if(!ranged || *p == '\0') break;
+      if(voided_filter(start, end, p) == -1)
+        voided_set_status_msg("can't run filter: %s", 1, strerror(errno));
+      goto done;
+  }
+  voided_set_status_msg("invalid command", 1);
+  return 1;
+
+done:
+  if(before != E.buf->numrows && E.cy > start) E.cy = start;
+  if(E.cy > E.buf->numrows) E.cy = E.buf->numrows;
+  E.cx = 0;
+  return 1;
+}
+
+/*** registers ***/
+
+// a piece of a row held by a register. chars is a reference to the row's
+// contents at yank time, so yanking never copies any text
+struct regspan{
+  char *chars;
+  int off, len;
+};
+
+struct reg{
+  char linewise;
+  int nspans;
+  struct regspan *spans;   // one per row
+};
+
+#define REG_UNNAMED 26
+
+struct reg regs[REG_UNNAMED + 1];   // registers a-z, then the unnamed one
+
+void voided_reg_clear(struct reg *r){
+  int i;
+  for(i = 0; i < r->nspans; i++)
+    voided_chars_unref(r->spans[i].chars);
+  free(r->spans);
+  r->spans = NULL;
+  r->nspans = 0;
+}
+
+// yanks rows sy to ey into r. char-wise yanks start at sx in the first row
+// and stop before ex in the last one
+void voided_yank(struct reg *r, const int sy, const int sx, const int ey,
+                 const int ex, const char linewise){
+  voided_reg_clear(r);
+  r->linewise = linewise;
+  r->nspans = ey - sy + 1;
+  r->spans = malloc(sizeof(struct regspan) * r->nspans);
 
-  erow *row = &E.row[E.cy];
-  if(E.cx > 0){
-    voided_row_del_char(row, E.cx - 1);
-    E.cx--;
-  } else{
-    E.cx = E.row[E.cy - 1].size;
-    voided_row_append_string(&E.row[E.cy - 1], row->chars, row->size);
-    voided_del_row(E.cy);
-    E.cy--;
+  int y;
+  for(y = sy; y <= ey; y++){
+    erow *row = voided_row(y);
+    struct regspan *span = &r->spans[y - sy];
+    span->chars = voided_chars_ref(row->chars);
+    span->off = (!linewise && y == sy) ? sx : 0;
+    span->len = ((!linewise && y == ey) ? ex : row->size) - span->off;
   }
 }
 
-/*** file i/o ***/
+// turns a register span into row contents, sharing the yanked string
+// instead of copying it when the span covers all of it
+char *voided_span_chars(const struct regspan *span){
+  if(span->off == 0 && span->chars[span->len] == '\0')
+    return voided_chars_ref(span->chars);
+  return voided_chars_new(&span->chars[span->off], span->len);
+}
 
-// converts all rows into one big heap-allocated buffer.
-// ***DO NOT FORGET TO FREE THE RETURNED BUF!***
-char *voided_rows_to_string(int *buflen){
-  int totlen = 0;
-  int j;
+// puts the contents of r after the cursor (or before it, for 'P').
+// multi-row puts are spliced into the buffer in a single insertion
+void voided_put(const struct reg *r, const char before){
+  if(r->nspans == 0){
+    voided_set_status_msg("nothing in register", 1);
+    return;
+  }
+  int n = r->nspans;
+  const struct regspan *last = &r->spans[n - 1];
 
-  for(j = 0; j < E.numrows; j++)
-    totlen += E.row[j].size + 1;
-  *buflen = totlen;
+  if(r->linewise){
+    int at = before ? E.cy : E.cy + 1;
+    if(at > E.buf->numrows) at = E.buf->numrows;
 
-  char *buf = malloc(totlen);
-  char *p = buf;
-  
-  for(j = 0; j < E.numrows; j++){
-    memcpy(p, E.row[j].chars, E.row[j].size);
-    p += E.row[j].size;
-    *p = '\n';
-    p++;
+    erow *rows = malloc(sizeof(erow) * n);
+    int i;
+    for(i = 0; i < n; i++){
+      rows[i].size = r->spans[i].len;
+      rows[i].chars = voided_span_chars(&r->spans[i]);
+      rows[i].rsize = 0;
+      rows[i].render = NULL;
+    }
+    voided_insert_rows(at, rows, n);
+    free(rows);
+
+    E.cy = at;
+    E.cx = 0;
+    return;
   }
 
-  return buf;
-}
+  if(E.cy == E.buf->numrows) voided_insert_row(E.buf->numrows, "", 0);
+  erow *row = voided_row(E.cy);
+  int at = (before || row->size == 0) ? E.cx : E.cx + 1;
+  if(at > row->size) at = row->size;
 
-// opens file and appends each line to a row 
-void voided_open(const char *filename){
-  free(E.filename);
-  E.filename = strdup(filename);
+  if(n == 1){
+    voided_row_insert_string(row, at, &last->chars[last->off], last->len);
+    E.cx = at + (last->len > 0 ? last->len - 1 : 0);
+    return;
+  }
 
-  FILE *fp = fopen(filename, "r");
-  if(!fp) die("fopen");
+  // the text after the cursor ends up behind the last row that was put
+  erow *rows = malloc(sizeof(erow) * (n - 1));
+  int taillen = row->size - at;
+  int i;
+  for(i = 1; i < n - 1; i++){
+    rows[i - 1].size = r->spans[i].len;
+    rows[i - 1].chars = voided_span_chars(&r->spans[i]);
+    rows[i - 1].rsize = 0;
+    rows[i - 1].render = NULL;
+  }
+  erow *tail = &rows[n - 2];
+  tail->size = last->len + taillen;
+  tail->chars = voided_chars_new(NULL, tail->size);
+  memcpy(tail->chars, &last->chars[last->off], last->len);
+  memcpy(&tail->chars[last->len], &row->chars[at], taillen);
+  tail->rsize = 0;
+  tail->render = NULL;
 
-  char *line = NULL;
-  size_t linecap = 0;
-  ssize_t linelen;
+  voided_row_truncate(row, at);
+  voided_row_append_string(row, &r->spans[0].chars[r->spans[0].off], r->spans[0].len);
+  voided_insert_rows(E.cy + 1, rows, n - 1);
+  free(rows);
+  E.cx = at;
+}
 
-  while((linelen = getline(&line, &linecap, fp)) != -1){
-    while(linelen > 0 && (line[linelen - 1] == '\n' ||
-                          line[linelen - 1] == '\r'))
-      linelen--;
-    voided_insert_row(E.numrows, line, linelen);
+// deletes the text between (sy, sx) and (ey, ex), ex exclusive, joining
+// what is left of the first and last rows
+void voided_del_span(const int sy, const int sx, const int ey, const int ex){
+  if(sy == ey){
+    voided_row_del_string(voided_row(sy), sx, ex - sx);
+    return;
   }
-  free(line);
-  fclose(fp);
-  E.dirty = 0;
+  erow *last = voided_row(ey);
+  voided_row_truncate(voided_row(sy), sx);
+  voided_row_append_string(voided_row(sy), &last->chars[ex], last->size - ex);
+  voided_del_rows(sy + 1, ey);
 }
 
-char voided_save(){
-  if(E.filename == NULL){
-    E.filename = voided_prompt("save as: %s");
-    if(E.filename == NULL){
-      voided_set_status_msg("save aborted", 1);
-      return 1;
-    }
-  }
-  int len;
-  char *buf = voided_rows_to_string(&len);
+/*** visual mode ***/
 
-  int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-  if(fd != -1){
-    if(ftruncate(fd, len) != -1){
-      if(write(fd, buf, len) == len){
-	close(fd);
-	free(buf);
-	voided_set_status_msg("wrote %d bytes to '%s'", 1, len, E.filename);
-	E.dirty = 0;
-	return 0;
-      }
-    }
-    close(fd);
-  }
-  free(buf);
-  voided_set_status_msg("can't save! I/O error: %s", 1, strerror(errno));
-  return 0;
+void voided_visual_start(const char linewise){
+  E.mode = VISUAL;
+  E.vline = linewise;
+  E.vx = E.cx;
+  E.vy = E.cy;
+  voided_set_status_msg(linewise ? "--VISUAL LINE--" : "--VISUAL--", 0);
 }
 
-/*** find ***/
+void voided_visual_end(){
+  E.mode = NORMAL;
+  voided_set_status_msg("", 0);
+}
 
-void voided_find(){
-  char *query = voided_prompt("/%s");
-  if(query == NULL) return;
+// gets the selection in buffer order, with the end column exclusive.
+// returns 0 if there is nothing to select
+int voided_visual_bounds(int *sy, int *sx, int *ey, int *ex){
+  if(E.buf->numrows == 0) return 0;
+  int ay = E.vy, ax = E.vx, by = E.cy, bx = E.cx;
+  if(ay > by || (ay == by && ax > bx)){
+    ay = E.cy; ax = E.cx;
+    by = E.vy; bx = E.vx;
+  }
+  if(ay >= E.buf->numrows){
+    ay = E.buf->numrows - 1;
+    ax = voided_row(ay)->size;
+  }
+  if(by >= E.buf->numrows){
+    by = E.buf->numrows - 1;
+    bx = voided_row(by)->size;
+  } else if(bx < voided_row(by)->size){
+    bx++;
+  }
+  if(ax > voided_row(ay)->size) ax = voided_row(ay)->size;
 
-  int i;
-  for(i = 0; i < E.numrows; i++){
-    erow *row = &E.row[i];
-    char *match = strstr(row->render, query);
-    if(match){
-      E.cy = i;
-      E.cx = voided_row_rx_to_cx(row, match - row->render);
-      E.rowoff = E.numrows;
-      break;
+  *sy = ay; *sx = ax;
+  *ey = by; *ex = bx;
+  return 1;
+}
+
+// yanks the selection into the current register, deleting it too for 'd'
+void voided_visual_yank(const char cut){
+  int sy = 0, sx, ey = 0, ex;
+  if(voided_visual_bounds(&sy, &sx, &ey, &ex)){
+    voided_yank(&regs[E.reg], sy, sx, ey, ex, E.vline);
+    if(cut){
+      if(E.vline) voided_del_rows(sy, ey);
+      else voided_del_span(sy, sx, ey, ex);
     }
+    E.cy = sy;
+    E.cx = E.vline ? 0 : sx;
+    if(E.cy > E.buf->numrows) E.cy = E.buf->numrows;
   }
-  free(query);
+  E.reg = REG_UNNAMED;
+  voided_visual_end();
+  if(ey - sy > 0)
+    voided_set_status_msg("%d lines %s", 1, ey - sy + 1, cut ? "deleted" : "yanked");
+}
+
+// tells whether render column rx of filerow is in the visual selection,
+// as a range [*rs, *re) of render columns. returns 0 if the row isn't in it
+int voided_visual_cols(const int filerow, int *rs, int *re){
+  int sy, sx, ey, ex;
+  if(E.mode != VISUAL || !voided_visual_bounds(&sy, &sx, &ey, &ex)) return 0;
+  if(filerow < sy || filerow > ey) return 0;
+
+  erow *row = voided_row(filerow);
+  *rs = (!E.vline && filerow == sy) ? voided_row_cx_to_rx(row, sx) : 0;
+  *re = (!E.vline && filerow == ey) ? voided_row_cx_to_rx(row, ex) : row->rsize;
+  return 1;
 }
 
 /*** append buffer ***/
@@ -451,8 +3985,8 @@ void ab_free(struct abuf *ab){
 // operations to be done whenever cy changes or when rx goes out of bounds
 void voided_scroll(){
   E.rx = 0;
-  if(E.cy < E.numrows){
-    E.rx = voided_row_cx_to_rx(&E.row[E.cy], E.cx);
+  if(E.cy < E.buf->numrows){
+    E.rx = voided_row_cx_to_rx(voided_row(E.cy), E.cx);
   }
 
   if(E.cy < E.rowoff){
@@ -475,8 +4009,8 @@ void voided_draw_rows(struct abuf *ab){
   int y;
   for(y = 0; y < E.scrows; y++){
     int filerow = y + E.rowoff;
-    if(filerow >= E.numrows){
-      if(E.numrows == 0 && y == E.scrows / 3){
+    if(filerow >= E.buf->numrows){
+      if(E.buf->numrows == 0 && y == E.scrows / 3){
         char welcome[80];
         int welcomelen = snprintf(welcome, sizeof(welcome),
                          "Void editor -- version %s", VOID_VERSION);
@@ -492,10 +4026,30 @@ void voided_draw_rows(struct abuf *ab){
         ab_append(ab, "~", 1);
       }
     } else {
-      int len = E.row[filerow].rsize - E.coloff;
+      erow *row = voided_row(filerow);
+      char *render = voided_row_render(row);
+      int len = row->rsize - E.coloff;
       if(len < 0) len = 0;
       if(len > E.sccols) len = E.sccols;
-      ab_append(ab, &E.row[filerow].render[E.coloff], len);
+
+      int rs, re;
+      if(voided_visual_cols(filerow, &rs, &re)){
+        // split the visible part of the row around the selection
+        // both ends are clamped to what's on screen, which can be nothing
+        // at all when the row is scrolled out of view
+        int start = E.coloff, stop = E.coloff + len;
+        if(rs < start) rs = start;
+        if(rs > stop) rs = stop;
+        if(re < rs) re = rs;
+        if(re > stop) re = stop;
+        if(rs > start) ab_append(ab, &render[start], rs - start);
+        ab_append(ab, "\x1b[7m", 4);
+        if(re > rs) ab_append(ab, &render[rs], re - rs);
+        ab_append(ab, "\x1b[m", 3);
+        if(stop > re) ab_append(ab, &render[re], stop - re);
+      } else{
+        ab_append(ab, &render[E.coloff], len);
+      }
     }
     ab_append(ab, "\x1b[K", 3);
     ab_append(ab, "\r\n", 2);
@@ -507,9 +4061,9 @@ void voided_draw_status_bar(struct abuf *ab){
   char status[80], rstatus[80];
   char *filename;
   int fn_size;
-  if (E.filename != NULL){
-    filename = strdup(E.filename);
-    fn_size = strlen(E.filename);
+  if (E.buf->filename != NULL){
+    filename = strdup(E.buf->filename);
+    fn_size = strlen(E.buf->filename);
   } else{
     filename = NULL;
     fn_size = 0;
@@ -522,9 +4076,15 @@ void voided_draw_status_bar(struct abuf *ab){
     }
   }
   int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-                     filename ? filename : "[No Name]", E.numrows,
-		     E.dirty ? "(modified)" : "");
-  int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E.cy + 1, E.numrows);
+                     filename ? filename : "[No Name]", E.buf->numrows,
+		     E.buf->dirty ? "(modified)" : "");
+  int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E.cy + 1, E.buf->numrows);
+  if(nbufs > 1){
+    int b;
+    for(b = 0; b < nbufs && bufs[b] != E.buf; b++);
+    rlen = snprintf(rstatus, sizeof(rstatus), "[%d/%d] %d/%d", b + 1, nbufs,
+                    E.cy + 1, E.buf->numrows);
+  }
   if(len > E.sccols) len = E.sccols;
   ab_append(ab, status, len);
   while(len < E.sccols){
@@ -543,34 +4103,79 @@ void voided_draw_status_bar(struct abuf *ab){
 
 void voided_draw_msg_bar(struct abuf *ab){
   ab_append(ab, "\x1b[K", 3);
+  // an open prompt has the bar to itself
+  if(E.prompt.fmt){
+    char msg[sizeof(E.statusmsg)];
+    snprintf(msg, sizeof(msg), E.prompt.fmt, E.prompt.buf);
+    int len = strlen(msg);
+    ab_append(ab, msg, len < E.sccols ? len : E.sccols);
+    return;
+  }
   int msglen = strlen(E.statusmsg);
   if(msglen > E.sccols) msglen = E.sccols;
   if((msglen && time(NULL) - E.statusmsg_time < 5) || E.statusmsg_time == 0)
     ab_append(ab, E.statusmsg, msglen);
 }
 
-// called every frame. most render-related functions are called here
+void voided_free_frame(){
+  int y;
+  for(y = 0; y < E.framerows; y++)
+    ab_free(&E.frame[y]);
+  free(E.frame);
+  E.frame = NULL;
+  E.framerows = 0;
+}
+
+// called every frame. most render-related functions are called here.
+// the screen is drawn line by line and only the lines that differ from
+// the last frame are sent to the terminal
 void voided_refresh_screen(){
   voided_scroll();
 
   struct abuf ab = ABUF_INIT;
-
-  ab_append(&ab, "\x1b[?25l", 6);
-  ab_append(&ab, "\x1b[2J", 4);
-  ab_append(&ab, "\x1b[H", 3);
-
   voided_draw_rows(&ab);
   voided_draw_status_bar(&ab);
   voided_draw_msg_bar(&ab);
 
+  struct abuf out = ABUF_INIT;
+  ab_append(&out, "\x1b[?25l", 6);
+
+  int nlines = E.scrows + 2;
+  if(E.frame == NULL || E.framerows != nlines){
+    voided_free_frame();
+    E.frame = calloc(nlines, sizeof(struct abuf));
+    E.framerows = nlines;
+    ab_append(&out, "\x1b[2J", 4);
+  }
+
   char buf[32];
+  char *line = ab.b, *end = ab.b + ab.len;
+  int y;
+  for(y = 0; y < nlines && line != NULL && line <= end; y++){
+    char *eol = memmem(line, end - line, "\r\n", 2);
+    if(eol == NULL) eol = end;
+    int len = eol - line;
+
+    struct abuf *old = &E.frame[y];
+    if(old->b == NULL || old->len != len || memcmp(old->b, line, len) != 0){
+      snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1);
+      ab_append(&out, buf, strlen(buf));
+      ab_append(&out, line, len);
+      old->len = 0;
+      ab_append(old, line, len);
+      if(len == 0 && old->b == NULL) old->b = malloc(1);
+    }
+    line = eol + 2;
+  }
+
   snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1,
                                             (E.rx - E.coloff) + 1);
-  ab_append(&ab, buf, strlen(buf));
+  ab_append(&out, buf, strlen(buf));
 
-  ab_append(&ab, "\x1b[?25h", 6);
-  write(STDOUT_FILENO, ab.b, ab.len);
+  ab_append(&out, "\x1b[?25h", 6);
+  write(E.outfd, out.b, out.len);
 
+  ab_free(&out);
   ab_free(&ab);
 }
 
@@ -589,45 +4194,72 @@ void voided_set_status_msg(const char *fmt, const char t, ...){
 
 /*** input ***/
 
-// takes in input from the status message bar with a prompt 
-char *voided_prompt(char *prompt){
-  size_t bufsize = PROMPT_SIZE;
-  char *buf = malloc(bufsize);
+// opens a prompt in the message bar. keys go to it one at a time, as the
+// view gets them, until it's answered: then done is called with what was
+// typed (NULL if it was cancelled), which it is left to free
+void voided_prompt(const char *fmt, void (*done)(char *)){
+  E.prompt.fmt = fmt;
+  E.prompt.cap = PROMPT_SIZE;
+  E.prompt.buf = malloc(E.prompt.cap);
+  E.prompt.buf[0] = '\0';
+  E.prompt.len = 0;
+  E.prompt.confirm = 0;
+  E.prompt.done = done;
+}
 
-  size_t buflen = 0;
-  buf[0] = '\0';
+// asks a yes/no question about arg in the message bar. done gets "y" or "n"
+void voided_confirm(const char *fmt, const char *arg, void (*done)(char *)){
+  voided_prompt(fmt, done);
+  free(E.prompt.buf);
+  E.prompt.buf = strdup(arg);
+  E.prompt.confirm = 1;
+}
 
-  while(1){
-    voided_set_status_msg(prompt, 0, buf);
-    voided_refresh_screen();
+// closes the prompt and hands input to whoever opened it, which may well
+// open another one
+void voided_prompt_close(char *input){
+  void (*done)(char *) = E.prompt.done;
+  if(input != E.prompt.buf) free(E.prompt.buf);
+  E.prompt.fmt = NULL;
+  E.prompt.buf = NULL;
+  done(input);
+}
 
-    int c = voided_read_key();
+// closes the prompt, if there is one, as if it had been cancelled
+void voided_prompt_abandon(){
+  if(E.prompt.fmt) voided_prompt_close(NULL);
+}
 
-    if(c == BACKSPACE){
-      if(buflen != 0) buf[--buflen] = '\0';
-    } else if(c == '\x1b'){
-      voided_set_status_msg("", 1);
-      free(buf);
-      return NULL;
-    } else if(c == '\r'){
-      if(buflen != 0){
-	voided_set_status_msg("", 0);
-	return buf;
-      }
-    } else if(!iscntrl(c) && c < PROMPT_SIZE){
-      if(buflen == bufsize - 1){
-	bufsize *= 2;
-	buf = realloc(buf, bufsize);
-      }
-      buf[buflen++] = c;
-      buf[buflen] = '\0';
+// feeds a key to the open prompt
+void voided_prompt_key(const int c){
+  if(E.prompt.confirm){
+    if(c == 'y' || c == 'Y') voided_prompt_close(strdup("y"));
+    else if(c == 'n' || c == 'N' || c == ESC) voided_prompt_close(strdup("n"));
+    return;
+  }
+  if(c == BACKSPACE){
+    if(E.prompt.len != 0) E.prompt.buf[--E.prompt.len] = '\0';
+  } else if(c == ESC){
+    voided_set_status_msg("", 1);
+    voided_prompt_close(NULL);
+  } else if(c == '\r'){
+    if(E.prompt.len != 0){
+      voided_set_status_msg("", 0);
+      voided_prompt_close(E.prompt.buf);
     }
+  } else if(!iscntrl(c) && c < PROMPT_SIZE){
+    if(E.prompt.len == E.prompt.cap - 1){
+      E.prompt.cap *= 2;
+      E.prompt.buf = realloc(E.prompt.buf, E.prompt.cap);
+    }
+    E.prompt.buf[E.prompt.len++] = c;
+    E.prompt.buf[E.prompt.len] = '\0';
   }
 }
 
 // called whenever a cursor movement key is pressed 
 void voided_move_cursor(const char key){
-  erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+  erow *row = (E.cy >= E.buf->numrows) ? NULL : voided_row(E.cy);
 
   switch(key){
     case MV_LEFT:
@@ -636,7 +4268,7 @@ void voided_move_cursor(const char key){
       }
       break;
     case MV_DOWN:
-      if(E.cy < E.numrows){
+      if(E.cy < E.buf->numrows){
         E.cy++;
       }
       break;
@@ -652,13 +4284,45 @@ void voided_move_cursor(const char key){
       break;
   }
 
-  row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+  row = (E.cy >= E.buf->numrows) ? NULL : voided_row(E.cy);
   int rowlen = row ? row->size : 0;
   if(E.cx > rowlen){
     E.cx = rowlen;
   }
 }
 
+// called whenever voided_read_key() has been waiting a while for input
+void voided_idle(){
+  // buffers that aren't shown may still have edits on the way to their
+  // journals
+  voided_journal_tick_all();
+  if(voided_watch_tick()) voided_refresh_screen();
+}
+
+// the ':' prompt answered
+void voided_cmd_done(char *buf){
+  voided_process_cmd(buf);
+  free(buf);
+}
+
+// the second key of 'yy', 'dd' and '"a'
+void voided_process_pending(const int c){
+  char first = E.pending;
+  E.pending = 0;
+  if(first == '"'){
+    if(islower(c)) E.reg = c - 'a';
+    return;
+  }
+  // yy and dd work on the cursor's row
+  if(c != first || E.cy >= E.buf->numrows) return;
+  voided_yank(&regs[E.reg], E.cy, 0, E.cy, 0, 1);
+  E.reg = REG_UNNAMED;
+  if(first == 'd'){
+    voided_del_rows(E.cy, E.cy);
+    E.cx = 0;
+  }
+}
+
 // handles normal mode key presses
 void voided_process_normal(const int c){
   switch(c){
@@ -672,7 +4336,7 @@ void voided_process_normal(const int c){
           E.cy = E.rowoff;
         } else if(c == CTRL_KEY(MV_DOWN)){
           E.cy = E.rowoff + E.scrows - 1;
-          if(E.cy > E.numrows) E.cy = E.numrows;
+          if(E.cy > E.buf->numrows) E.cy = E.buf->numrows;
         }
         int times = E.scrows;
         while(times--){
@@ -681,25 +4345,25 @@ void voided_process_normal(const int c){
       }
       break;
     case '$':
-      if(E.cy < E.numrows)
-        E.cx = E.row[E.cy].size;
+      if(E.cy < E.buf->numrows)
+        E.cx = voided_row(E.cy)->size;
       break;
     case '^':
       E.cx = 0;
-      if(E.cy < E.numrows){
-	while(E.row[E.cy].chars[E.cx] == ' ' || E.row[E.cy].chars[E.cx] == '\t'){
+      if(E.cy < E.buf->numrows){
+	while(voided_row(E.cy)->chars[E.cx] == ' ' || voided_row(E.cy)->chars[E.cx] == '\t'){
 	  voided_move_cursor(MV_RIGHT);
 	}
       }
       break;
     case 'e':
-      if(E.cy == E.numrows) break;
-      if(E.row[E.cy].chars[E.cx + 1] == ' ') voided_move_cursor(MV_RIGHT);
+      if(E.cy == E.buf->numrows) break;
+      if(voided_row(E.cy)->chars[E.cx + 1] == ' ') voided_move_cursor(MV_RIGHT);
       while(1){
-	char a = E.row[E.cy].chars[E.cx];
-	char b = E.row[E.cy].chars[E.cx + 1];
+	char a = voided_row(E.cy)->chars[E.cx];
+	char b = voided_row(E.cy)->chars[E.cx + 1];
 	if(a == ' ' && b == ' '){
-	  while(E.row[E.cy].chars[E.cx] == ' ') voided_move_cursor(MV_RIGHT);
+	  while(voided_row(E.cy)->chars[E.cx] == ' ') voided_move_cursor(MV_RIGHT);
 	}
 	if((isalnum(a) && !isalnum(b)) || b == '\0') break;
 	if(!isalnum(a) && a != ' ') break;
@@ -720,13 +4384,13 @@ void voided_process_normal(const int c){
     case 'b':
       // TODO: fix b key (make it stop going backwards when there's
       // nothing but whitespace or tabs ahead)
-      if(E.cy == E.numrows) break;
-      if(E.row[E.cy].chars[E.cx - 1] == ' ') voided_move_cursor(MV_LEFT);
+      if(E.cy == E.buf->numrows) break;
+      if(voided_row(E.cy)->chars[E.cx - 1] == ' ') voided_move_cursor(MV_LEFT);
       while(1){
-	char a = E.row[E.cy].chars[E.cx];
-	char b = E.row[E.cy].chars[E.cx - 1];
+	char a = voided_row(E.cy)->chars[E.cx];
+	char b = voided_row(E.cy)->chars[E.cx - 1];
 	/* if(a == ' ' && b == ' '){ */
-	/*   while(E.row[E.cy].chars[E.cx] == ' ') voided_move_cursor(MV_LEFT); */
+	/*   while(voided_row(E.cy)->chars[E.cx] == ' ') voided_move_cursor(MV_LEFT); */
 	/* } */
 	if((isalnum(a) && !isalnum(b)) || b == '\0') break;
 	if(!isalnum(a) && a != ' ') break;
@@ -768,20 +4432,64 @@ void voided_process_normal(const int c){
       voided_set_status_msg("--INSERT--", 0);
       break;
     case ':':
-      tempbuf = 'c';    //comment this line out for an annoying compiler warning ;)
-      char *buf;
-      buf = voided_prompt(":%s");
-      voided_process_cmd(buf);
-      free(buf);
+      voided_prompt(":%s", voided_cmd_done);
       break;
     case '/':
       voided_find();
       break;
+    case 'v':
+    case 'V':
+      voided_visual_start(c == 'V');
+      break;
+    case 'y':
+    case 'd':
+      E.pending = c;
+      break;
+    case 'p':
+    case 'P':
+      voided_put(&regs[E.reg], c == 'P');
+      E.reg = REG_UNNAMED;
+      break;
+    case '"':
+      E.pending = c;
+      break;
+  }
+}
+
+// handles visual mode key presses
+void voided_process_visual(const int c){
+  switch(c){
+    case ESC:
+      voided_visual_end();
+      break;
+    case 'v':
+    case 'V':
+      if(E.vline == (c == 'V')){
+        voided_visual_end();
+      } else{
+        E.vline = (c == 'V');
+        voided_set_status_msg(E.vline ? "--VISUAL LINE--" : "--VISUAL--", 0);
+      }
+      break;
+    case 'y':
+    case 'd':
+      voided_visual_yank(c == 'd');
+      break;
+    case '"':
+      E.pending = c;
+      break;
+    default:
+      // motions behave the same as in normal mode
+      if((c != '\0' && strchr("hjkl$^eb", c)) ||
+         c == CTRL_KEY(MV_UP) || c == CTRL_KEY(MV_DOWN))
+        voided_process_normal(c);
+      break;
   }
 }
 
 // handles insert mode key presses
 void voided_process_insert(const int c){
+  if(c != CTRL_KEY('n') && c != CTRL_KEY('p')) voided_complete_end();
   switch(c){
     case ESC:
       E.mode = NORMAL;
@@ -808,6 +4516,10 @@ void voided_process_insert(const int c){
     case CTRL_KEY(MV_LEFT):
       voided_move_cursor(MV_LEFT);
       break;
+    case CTRL_KEY('n'):
+    case CTRL_KEY('p'):
+      voided_complete(c == CTRL_KEY('n') ? 1 : -1);
+      break;
   case '\t':
     tempbuf = 'c';
     int times = VOID_TAB_SIZE;
@@ -821,11 +4533,44 @@ void voided_process_insert(const int c){
   }
 }
 
+// leaves the editor. views of the daemon only detach from it
+void voided_quit(){
+  if(E.remote){
+    E.quit = 1;
+    return;
+  }
+  int i;
+  for(i = 0; i < nbufs; i++){
+    E.buf = bufs[i];
+    voided_journal_quit();
+  }
+  write(E.outfd, "\x1b[2J", 4);
+  write(E.outfd, "\x1b[H", 3);
+  exit(0);
+}
+
 // handles commands (anything typed after ':')
 void voided_process_cmd(char *buf){
   if(buf == NULL){
     return;
   }
+  if(strcmp(buf, "watch") == 0){
+    voided_watch_toggle();
+    return;
+  }
+  if(strcmp(buf, "stats") == 0){
+    voided_stats();
+    return;
+  }
+  if(buf[0] == 'e' && (buf[1] == ' ' || buf[1] == '\0')){
+    voided_buf_edit(buf[1] ? buf + 2 : "");
+    return;
+  }
+  if(strcmp(buf, "bn") == 0 || strcmp(buf, "bp") == 0){
+    voided_buf_cycle(buf[1] == 'n' ? 1 : -1);
+    return;
+  }
+  if(voided_process_ex(buf)) return;
   int i;
   for(i = 0; i < PROMPT_SIZE; i++){
     int c = buf[i];
@@ -842,17 +4587,16 @@ void voided_process_cmd(char *buf){
 	/*     if(buf[j + (i + 2)] != '\0') fnsize++; */
 	/*     else break; */
 	/*   } */
-	/*   free(E.filename); */
-	/*   E.filename = malloc(fnsize); */
-	/*   memcpy(E.filename, &buf[(i + 2)], fnsize); */
+	/*   free(E.buf->filename); */
+	/*   E.buf->filename = malloc(fnsize); */
+	/*   memcpy(E.buf->filename, &buf[(i + 2)], fnsize); */
 	/* } */
         voided_save();
 	return;
       case 'q':
         if(buf[(i + 1)] == '\0'){
-          write(STDOUT_FILENO, "\x1b[2J", 4);
-          write(STDOUT_FILENO, "\x1b[H", 3);
-          exit(0);
+          voided_quit();
+          return;
         } else{
 	  voided_set_status_msg("invalid command ('q' should come after any other command)", 1);
 	  return;
@@ -870,6 +4614,17 @@ void voided_process_cmd(char *buf){
 // called every frame, cursor-related functions are called here
 void voided_process_keypress(){
   char c = voided_read_key();
+  // a client of the daemon may have had nothing to send after all, or
+  // have gone away
+  if(E.remote && (c == '\0' || E.quit)) return;
+  if(E.prompt.fmt){
+    voided_prompt_key(c);
+    return;
+  }
+  if(E.pending){
+    voided_process_pending(c);
+    return;
+  }
 
   switch(E.mode){
     case NORMAL:
@@ -878,38 +4633,452 @@ void voided_process_keypress(){
     case INSERT:
       voided_process_insert(c);
       return;
+    case VISUAL:
+      voided_process_visual(c);
+      return;
+  }
+}
+
+
+/*** daemon ***/
+
+// 'voided --daemon' keeps buffers loaded between sessions. a plain 'voided'
+// finding it running attaches to it as a thin client: keys are forwarded
+// as they're typed, and the daemon sends back only the screen lines that
+// changed. clients opening the same file share one buffer
+
+#define DAEMON_MAGIC "VOI2"     // changes along with struct hello
+#define DAEMON_MAX_FILES 64      // files a client can hand the daemon at once
+#define DAEMON_HELLO_TIME 2      // seconds a client has to send its hello
+
+// first thing a client sends, followed by namelen bytes of file path
+struct hello{
+  char magic[4];
+  int rows, cols;
+  char force;              // -L was given
+  char compress;           // -z was given
+  int namelen;             // of the client's directory and then the file
+                           // names, each ending in a nul
+};
+
+struct ed_config *clients;  // one view per attached client
+int nclients;
+
+// a client that has connected but not sent all of its hello yet
+struct greeting{
+  int fd;
+  struct hello h;
+  char *names;             // set once the hello itself is in
+  long got;                // bytes of the hello and names read so far
+  time_t since;
+};
+
+struct greeting *greetings;
+int ngreetings;
+
+// the socket is made in a directory of our own, $XDG_RUNTIME_DIR/voided or
+// /tmp/voided-<uid>, so that nobody else can put one there first. returns
+// -1 if the directory can't be made, or is there but isn't ours alone
+int voided_socket_path(struct sockaddr_un *addr){
+  char dir[sizeof(addr->sun_path)];
+  const char *base = getenv("XDG_RUNTIME_DIR");
+  if(base && *base) snprintf(dir, sizeof(dir), "%s/voided", base);
+  else snprintf(dir, sizeof(dir), "/tmp/voided-%d", (int)getuid());
+  if(mkdir(dir, 0700) == -1 && errno != EEXIST) return -1;
+
+  struct stat st;
+  if(lstat(dir, &st) == -1) return -1;
+  if(!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077)){
+    errno = EPERM;
+    return -1;
+  }
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if(snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/sock", dir) >= (int)sizeof(addr->sun_path)){
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  return 0;
+}
+
+// whether the other end of the socket fd runs as the same user we do
+int voided_peer_ours(const int fd){
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+}
+
+// connects to a running daemon. returns -1 if there is none. a daemon run
+// by someone else is never talked to
+int voided_daemon_connect(){
+  struct sockaddr_un addr;
+  if(voided_socket_path(&addr) == -1) return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd == -1) return -1;
+  if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1){
+    close(fd);
+    return -1;
+  }
+  if(!voided_peer_ours(fd)){
+    fprintf(stderr, "voided: %s belongs to another user, not attaching\n", addr.sun_path);
+    exit(1);
+  }
+  return fd;
+}
+
+// reads a key from a daemon client. it's only asked for once poll() has
+// seen one coming, so this never waits: '\0' comes back if there was
+// nothing after all, and the view is flagged to detach if the client went
+// away
+char voided_remote_read_key(){
+  char c;
+  ssize_t n;
+  while((n = read(E.infd, &c, 1)) == -1 && errno == EINTR)
+    ;
+  if(n == 1) return c;
+  if(n == 0 || errno != EAGAIN) E.quit = 1;
+  return '\0';
+}
+
+// redraws every client looking at buffer b
+void voided_daemon_refresh(const struct ebuf *b){
+  struct ed_config self = E;
+  int i;
+  for(i = 0; i < nclients; i++){
+    if(clients[i].buf != b || clients[i].quit) continue;
+    E = clients[i];
+    voided_view_clamp();
+    voided_refresh_screen();
+    clients[i] = E;
+  }
+  E = self;
+}
+
+// takes in a client that has said hello, loading the files it asks for
+// unless some other client already has
+void voided_daemon_attach(const int fd, const struct hello *h, char *name){
+  struct ed_config self = E;
+  voided_view_init(NULL, fd, fd);
+  E.remote = 1;
+  E.scrows = h->rows - 2;
+  E.sccols = h->cols;
+  voided_set_status_msg(HELP_MSG, 1);
+  E.lf_force = h->force;
+  E.lf_compress = h->compress;
+
+  // relative names are the client's, in its directory
+  if(name[0] == '/') E.cwd = strdup(name);
+
+  // a buffer for every file, unless some other client already has one
+  struct ebuf *first = NULL;
+  char *p = name + strlen(name) + 1;
+  while(p < name + h->namelen){
+    char *path = voided_view_path(p);
+    struct ebuf *b = voided_buf_find(path);
+    if(b == NULL) b = voided_buf_new(path);
+    free(path);
+    if(first == NULL) first = b;
+    p += strlen(p) + 1;
+  }
+  if(first == NULL) first = voided_buf_new(NULL);
+  char shared = first->views > 0;
+  voided_buf_show(first);
+  if(shared) voided_set_status_msg("attached to '%s'", 1, first->filename);
+
+  clients = realloc(clients, sizeof(struct ed_config) * (nclients + 1));
+  clients[nclients++] = E;
+  E = self;
+  voided_daemon_refresh(clients[nclients - 1].buf);
+}
+
+// takes in a new connection. its hello is read as it comes in, so that a
+// client that is slow to send it doesn't hold up the others
+void voided_daemon_accept(const int lfd){
+  int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+  if(fd == -1) return;
+  if(!voided_peer_ours(fd)){
+    close(fd);
+    return;
+  }
+  greetings = realloc(greetings, sizeof(struct greeting) * (ngreetings + 1));
+  struct greeting *g = &greetings[ngreetings++];
+  memset(g, 0, sizeof(*g));
+  g->fd = fd;
+  g->since = time(NULL);
+}
+
+// reads whatever has come in of greeting i's hello when ready is set.
+// once all of it is there the client is attached; one that sends a bad
+// hello or takes longer than DAEMON_HELLO_TIME is dropped
+void voided_daemon_greet(const int i, const char ready){
+  struct greeting *g = &greetings[i];
+  long hlen = sizeof(g->h);
+  char ok = 1;
+  if(ready){
+    char *dst = g->got < hlen ? (char *)&g->h + g->got : g->names + (g->got - hlen);
+    long want = g->got < hlen ? hlen - g->got : hlen + g->h.namelen - g->got;
+    ssize_t n = read(g->fd, dst, want);
+    if(n > 0) g->got += n;
+    else if(n == 0 || (errno != EINTR && errno != EAGAIN)) ok = 0;
+
+    if(ok && g->got == hlen && g->names == NULL){
+      if(memcmp(g->h.magic, DAEMON_MAGIC, 4) != 0 || g->h.namelen < 0 ||
+         g->h.namelen > (DAEMON_MAX_FILES + 1) * PATH_MAX || g->h.rows < 3 || g->h.cols < 1)
+        ok = 0;
+      else
+        g->names = malloc(g->h.namelen + 1);
+    }
+  }
+
+  if(ok && g->names && g->got == hlen + g->h.namelen){
+    g->names[g->h.namelen] = '\0';
+    voided_daemon_attach(g->fd, &g->h, g->names);
+  } else if(ok && time(NULL) - g->since <= DAEMON_HELLO_TIME){
+    return;
+  } else{
+    close(g->fd);
+  }
+  free(g->names);
+  greetings[i] = greetings[--ngreetings];
+}
+
+void voided_daemon_detach(const int i){
+  struct ed_config self = E;
+  E = clients[i];
+  // a question nobody is left to answer
+  voided_prompt_abandon();
+  close(E.infd);
+  free(E.cwd);
+  voided_free_frame();
+  E.buf->views--;
+  E = self;
+  clients[i] = clients[--nclients];
+}
+
+// runs voided as a daemon listening on its socket. it only returns if it
+// couldn't start
+int voided_daemon(){
+  struct sockaddr_un addr;
+  if(voided_socket_path(&addr) == -1){
+    perror("voided: can't make a place for the socket");
+    return -1;
+  }
+
+  int fd = voided_daemon_connect();
+  if(fd != -1){
+    close(fd);
+    fprintf(stderr, "voided: a daemon is already listening on %s\n", addr.sun_path);
+    return -1;
+  }
+  unlink(addr.sun_path);
+
+  int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  mode_t mask = umask(077);
+  if(lfd == -1 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+     listen(lfd, 16) == -1){
+    umask(mask);
+    perror("voided: can't listen");
+    return -1;
+  }
+  umask(mask);
+
+  if(daemon(0, 0) == -1) return -1;
+  signal(SIGPIPE, SIG_IGN);
+  // E is swapped with each client's view while serving it; between
+  // clients it is a stand-in view that isn't drawn anywhere
+  voided_view_init(NULL, -1, -1);
+  E.remote = 1;
+
+  while(1){
+    int nc = nclients, ng = ngreetings;
+    struct pollfd *pfds = malloc(sizeof(struct pollfd) * (1 + nc + ng));
+    pfds[0].fd = lfd;
+    pfds[0].events = POLLIN;
+    int i, ahead = 0;
+    for(i = 0; i < nc; i++){
+      pfds[1 + i].fd = clients[i].infd;
+      pfds[1 + i].events = POLLIN;
+      pfds[1 + i].revents = 0;
+      // keys held back during a filter are served without waiting
+      if(clients[i].nahead > 0) ahead = 1;
+    }
+    for(i = 0; i < ng; i++){
+      pfds[1 + nc + i].fd = greetings[i].fd;
+      pfds[1 + nc + i].events = POLLIN;
+    }
+    int r = poll(pfds, 1 + nc + ng, ahead ? 0 : 100);
+
+    // journals and watched files of every buffer, on behalf of some
+    // client looking at it
+    int b;
+    for(b = 0; b < nbufs; b++){
+      struct ed_config self = E;
+      int v;
+      for(v = 0; v < nclients && clients[v].buf != bufs[b]; v++);
+      E.buf = bufs[b];
+      if(v < nclients) E = clients[v];
+      voided_journal_tick();
+      int changed = voided_watch_tick();
+      if(v < nclients) clients[v] = E;
+      E = self;
+      if(changed) voided_daemon_refresh(bufs[b]);
+    }
+
+    // clients are served from the last, so detaching one doesn't move
+    // the ones still to be looked at
+    for(i = nc - 1; (r > 0 || ahead) && i >= 0; i--){
+      if(!(pfds[1 + i].revents & (POLLIN | POLLHUP | POLLERR)) && clients[i].nahead == 0) continue;
+      struct ed_config self = E;
+      E = clients[i];
+      voided_view_clamp();
+      voided_process_keypress();
+      clients[i] = E;
+      E = self;
+      if(clients[i].quit){
+        voided_daemon_detach(i);
+      } else{
+        voided_daemon_refresh(clients[i].buf);
+      }
+    }
+    // greetings are looked at even without input, to time them out
+    for(i = ng - 1; i >= 0; i--)
+      voided_daemon_greet(i, r > 0 && (pfds[1 + nc + i].revents & (POLLIN | POLLHUP | POLLERR)));
+    if(r > 0 && (pfds[0].revents & POLLIN)) voided_daemon_accept(lfd);
+    free(pfds);
+  }
+  return 0;
+}
+
+// runs voided as a client of the daemon on fd: keys go straight to the
+// daemon, and what it sends back goes straight to the terminal
+void voided_client(const int fd, char **files, const int nfiles, const char force,
+                   const char compress){
+  // the daemon gets our directory, then the names as they were given,
+  // one after the other with a nul after each
+  struct abuf names = ABUF_INIT;
+  char cwd[PATH_MAX];
+  if(getcwd(cwd, sizeof(cwd)) == NULL) cwd[0] = '\0';
+  ab_append(&names, cwd, strlen(cwd) + 1);
+  int i;
+  for(i = 0; i < nfiles && i < DAEMON_MAX_FILES; i++)
+    ab_append(&names, files[i], strlen(files[i]) + 1);
+
+  struct hello h;
+  memcpy(h.magic, DAEMON_MAGIC, 4);
+  h.force = force;
+  h.compress = compress;
+  h.namelen = names.len;
+  enable_raw_mode();
+  if(get_window_size(&h.rows, &h.cols) == -1) die("get_window_size");
+  if(voided_write_all(fd, (char *)&h, sizeof(h)) == -1 ||
+     voided_write_all(fd, names.b, names.len) == -1) die("write");
+  ab_free(&names);
+
+  char buf[65536];
+  struct pollfd pfds[2] = {{STDIN_FILENO, POLLIN, 0}, {fd, POLLIN, 0}};
+  while(1){
+    if(poll(pfds, 2, -1) == -1){
+      if(errno == EINTR) continue;
+      die("poll");
+    }
+    if(pfds[0].revents & POLLIN){
+      ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+      if(n > 0 && voided_write_all(fd, buf, n) == -1) break;
+    }
+    if(pfds[1].revents & (POLLIN | POLLHUP)){
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if(n <= 0) break;
+      voided_write_all(STDOUT_FILENO, buf, n);
+    }
   }
+  write(STDOUT_FILENO, "\x1b[2J", 4);
+  write(STDOUT_FILENO, "\x1b[H", 3);
+  exit(0);
 }
 
 /*** init ***/
 
-void voided_init(){
+// resets E to a fresh view of buffer b, talking to the terminal on infd
+// and outfd
+void voided_view_init(struct ebuf *b, const int infd, const int outfd){
   E.cx = 0;
   E.cy = 0;
   E.rx = 0;
   E.rowoff = 0;
   E.coloff = 0;
-  E.numrows = 0;
-  E.row = NULL;
-  E.dirty = 0;
-  E.filename = NULL;
+  E.buf = b;
   E.statusmsg[0] = '\0';
   E.statusmsg_time = 0;
   E.mode = NORMAL;
+  E.reg = REG_UNNAMED;
+  E.infd = infd;
+  E.outfd = outfd;
+  E.remote = 0;
+  E.lf_force = 0;
+  E.lf_compress = 0;
+  E.cwd = NULL;
+  E.quit = 0;
+  E.frame = NULL;
+  E.framerows = 0;
+  E.prompt.fmt = NULL;
+  E.prompt.buf = NULL;
+  E.pending = 0;
+  E.nahead = 0;
+}
+
+void voided_init(){
+  voided_view_init(NULL, STDIN_FILENO, STDOUT_FILENO);
 
   if(get_window_size(&E.scrows, &E.sccols) == -1) die("get_window_size");
   E.scrows -= 2;
 }
 
+// usage: voided [-L] [-z] [-m megabytes] [--daemon] [file...]
+//   -L        open the file in large file mode, whatever its size
+//   -z        large file mode, keeping edited rows that fall out of the
+//             budget compressed in memory instead of in a temporary file
+//   -m        memory budget for each large file (files bigger than this are
+//             always opened in large file mode) and for all buffers together
+//   --daemon  keep buffers loaded in a background daemon. while it runs,
+//             voided attaches to it instead of loading files itself
 int main(int argc, char **argv){
+  char **files = malloc(sizeof(char *) * argc);
+  int nfiles = 0;
+  char daemonize = 0, force = 0, compress = 0;
+  lf_budget = (long)VOID_LF_BUDGET << 20;
+  int i;
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-L") == 0){
+      force = 1;
+    } else if(strcmp(argv[i], "-z") == 0){
+      compress = 1;
+    } else if(strcmp(argv[i], "-m") == 0 && i + 1 < argc){
+      long mb = atol(argv[++i]);
+      if(mb > 0) lf_budget = mb << 20;
+    } else if(strcmp(argv[i], "--daemon") == 0){
+      daemonize = 1;
+    } else{
+      files[nfiles++] = argv[i];
+    }
+  }
+
+  if(daemonize) return voided_daemon() == -1 ? 1 : 0;
+  int fd = voided_daemon_connect();
+  if(fd != -1) voided_client(fd, files, nfiles, force, compress);
+
   enable_raw_mode();
   voided_init();
-
-  if(argc >= 2){
-    voided_open(argv[1]);
-  }
+  E.lf_force = force;
+  E.lf_compress = compress;
 
   voided_set_status_msg(HELP_MSG, 1);
+  // only the first file is read in now, the others when they're shown
+  // a file named twice, even differently, still gets a single buffer
+  for(i = 0; i < nfiles; i++)
+    if(voided_buf_find(files[i]) == NULL) voided_buf_new(files[i]);
+  if(nfiles == 0) voided_buf_new(NULL);
+  free(files);
+  voided_buf_show(bufs[0]);
 
   while(1){
     voided_refresh_screen();